@@ -0,0 +1,436 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cachesim.h"
+#include "trace.h"
+
+/* Benchmark of libcachesim
+ *
+ * Generates synthetic traces in memory and times the simulation of every combination of the given
+ * cache sizes, mappings and organizations on each of them. Every trace is also written as a text
+ * trace to a temporary file and parsed back, so the parse time is reported separately from the
+ * simulation time. Each measurement is the best of a number of repetitions.
+ */
+
+typedef enum {
+    sequential, strided, uniform, zipf, interleaved
+} pattern_t;
+
+static const char *const pattern_names[] = {
+        [sequential] = "sequential", [strided] = "strided", [uniform] = "uniform", [zipf] = "zipf",
+        [interleaved] = "interleaved"};
+#define PATTERN_COUNT 5
+
+/* Data accesses start at DATA_BASE, the instructions of the interleaved pattern at CODE_BASE */
+#define DATA_BASE 0x10000000u
+#define CODE_BASE 0x00400000u
+
+/* Largest footprint that fits below the end of the 32 bit address space */
+#define MAX_FOOTPRINT (1u << 28)
+
+typedef struct {
+    uint64_t accesses;      // accesses per trace
+    uint32_t footprint;     // bytes touched by the data accesses
+    uint32_t stride;        // distance of consecutive accesses of the strided pattern
+    double zipf_exponent;   // skew of the zipf pattern, 0 is uniform
+    uint64_t seed;
+} pattern_config_t;
+
+/* xorshift64*, deterministic for a given seed */
+static inline uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Random number in [0, n) */
+static inline uint32_t random_below(uint64_t *state, uint32_t n) {
+    return (uint32_t) (((next_random(state) >> 32) * n) >> 32);
+}
+
+/* Cumulative distribution of a zipf distribution over count ranks */
+static double *zipf_distribution(uint32_t count, double exponent) {
+    double *cdf = malloc(count * sizeof(double));
+    double sum = 0;
+    for (uint32_t rank = 0; rank < count; rank++) {
+        sum += 1.0 / pow(rank + 1.0, exponent);
+        cdf[rank] = sum;
+    }
+    for (uint32_t rank = 0; rank < count; rank++) {
+        cdf[rank] /= sum;
+    }
+    return cdf;
+}
+
+/* First rank whose cumulative probability is at least p */
+static uint32_t zipf_rank(const double *cdf, uint32_t count, double p) {
+    uint32_t low = 0, high = count - 1;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (cdf[mid] < p) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Generates a synthetic trace
+ *
+ * sequential walks through the footprint word by word, strided in steps of the stride, uniform picks
+ * random words of the footprint. zipf picks blocks of the footprint by a zipf distribution, the ranks are
+ * scattered over the footprint so the hot set is spread over the sets. interleaved mixes sequential
+ * instruction fetches from a code region of a quarter of the footprint with uniform data accesses, one data
+ * access after every two instructions. The patterns wrap around at the end of the footprint.
+ * @param pattern pattern to generate
+ * @param config size and shape of the pattern
+ * @return array of config->accesses accesses, to be freed by the caller
+ */
+mem_access_t *generate_pattern(pattern_t pattern, const pattern_config_t *config) {
+    mem_access_t *accesses = malloc(config->accesses * sizeof(mem_access_t));
+    uint64_t state = config->seed ? config->seed : 1;
+    uint32_t words = config->footprint / 4;
+    uint32_t blocks = config->footprint / DEFAULT_BLOCK_SIZE;
+    uint32_t code_words = words / 4 ? words / 4 : 1;
+    double *cdf = pattern == zipf ? zipf_distribution(blocks, config->zipf_exponent) : NULL;
+    uint32_t offset = 0;
+    uint32_t pc = 0;
+
+    for (uint64_t i = 0; i < config->accesses; i++) {
+        mem_access_t *access = &accesses[i];
+        access->accesstype = data;
+        access->repeats = 0;
+        switch (pattern) {
+            case sequential:
+                access->address = DATA_BASE + (uint32_t) (i % words) * 4;
+                break;
+            case strided:
+                access->address = DATA_BASE + offset;
+                offset = (uint32_t) (((uint64_t) offset + config->stride) % config->footprint);
+                break;
+            case uniform:
+                access->address = DATA_BASE + random_below(&state, words) * 4;
+                break;
+            case zipf: {
+                double p = (double) (next_random(&state) >> 11) * 0x1.0p-53;
+                uint32_t rank = zipf_rank(cdf, blocks, p);
+                /* 2654435761 is a prime larger than the block count, so the product permutes the blocks */
+                uint32_t block = (uint32_t) ((rank * 2654435761ULL) % blocks);
+                access->address = DATA_BASE + block * DEFAULT_BLOCK_SIZE + random_below(&state, DEFAULT_BLOCK_SIZE / 4) * 4;
+                break;
+            }
+            case interleaved:
+                if (i % 3 == 2) {
+                    access->address = DATA_BASE + random_below(&state, words) * 4;
+                } else {
+                    access->accesstype = instruction;
+                    access->address = CODE_BASE + pc * 4;
+                    pc = pc + 1 == code_words ? 0 : pc + 1;
+                }
+                break;
+        }
+    }
+    free(cdf);
+    return accesses;
+}
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *stop) {
+    return (double) (stop->tv_sec - start->tv_sec) + (double) (stop->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/**
+ * Writes accesses as a text trace
+ * @param path path of the trace
+ * @param accesses accesses to write
+ * @param count number of accesses
+ * @return 0 on success, 1 otherwise
+ */
+int write_text_trace(const char *path, const mem_access_t *accesses, uint64_t count) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return 1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        fprintf(file, "%c %" PRIx32 "\n", accesses[i].accesstype == instruction ? 'I' : 'D', accesses[i].address);
+    }
+    int failed = ferror(file);
+    return fclose(file) != 0 || failed;
+}
+
+/**
+ * Times parsing a text trace into memory
+ * @param path path of the trace
+ * @param expected number of accesses the trace holds
+ * @param repeat number of repetitions
+ * @return the shortest time in seconds, negative if the trace could not be read back
+ */
+double time_parse(const char *path, uint64_t expected, unsigned int repeat) {
+    double best = -1;
+    for (unsigned int r = 0; r < repeat; r++) {
+        struct timespec start, stop;
+        uint64_t count;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        trace_t *trace = open_trace(path);
+        if (!trace) {
+            return -1;
+        }
+        mem_access_t *accesses = load_trace(trace, &count);
+        int failed = trace_error(trace) != NULL;
+        close_trace(trace);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        free(accesses);
+        if (failed || count != expected) {
+            return -1;
+        }
+        double seconds = elapsed_seconds(&start, &stop);
+        if (best < 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+/**
+ * Times simulating accesses on a cold cache
+ *
+ * Every repetition simulates on a new simulation, only simulate_accesses is timed
+ * @param config cache configuration
+ * @param accesses accesses to simulate
+ * @param count number of accesses
+ * @param repeat number of repetitions
+ * @param stats set to the statistics of the simulation
+ * @return the shortest time in seconds
+ */
+double time_simulation(const cache_config_t *config, const mem_access_t *accesses, uint64_t count,
+                       unsigned int repeat, cache_stat_t *stats) {
+    double best = -1;
+    for (unsigned int r = 0; r < repeat; r++) {
+        struct timespec start, stop;
+        simulation_t *sim = init_simulation(config);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        simulate_accesses(sim, accesses, count);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        *stats = simulation_statistics(sim);
+        free_simulation(sim);
+        double seconds = elapsed_seconds(&start, &stop);
+        if (best < 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+/* Splits a comma separated list in place, returns the number of items */
+static unsigned int split_list(char *list, char **items, unsigned int max_items) {
+    unsigned int count = 0;
+    char *item;
+    while ((item = strsep(&list, ",")) != NULL) {
+        if (count == max_items) {
+            return max_items + 1;
+        }
+        items[count++] = item;
+    }
+    return count;
+}
+
+/* Prints one result to stdout and to the CSV file, config is NULL for parse results */
+static void report(FILE *csv, pattern_t pattern, const cache_config_t *config, uint64_t accesses, double seconds,
+                   const cache_stat_t *stats) {
+    double per_second = (double) accesses / seconds;
+    double ns = seconds * 1e9 / (double) accesses;
+    if (config) {
+        uint64_t block_count;
+        uint32_t ways;
+        cache_geometry(config, &block_count, &ways);
+        double hit_rate = stats->accesses ? (double) stats->hits / stats->accesses : 0.0;
+        printf("%-12s simulate %8" PRIu32 " %-3s %-3s %12.1f %10.2f %9.4f\n", pattern_names[pattern],
+               config->cache_size, mapping_names[config->mapping], org_names[config->org], per_second / 1e6, ns,
+               hit_rate);
+        fprintf(csv, "%s,simulate,%" PRIu32 ",%s,%s,%" PRIu32 ",%s,%" PRIu64 ",%.9f,%.0f,%.3f,%.6f\n",
+                pattern_names[pattern], config->cache_size, mapping_names[config->mapping], org_names[config->org],
+                ways, policy_names[config->policy], accesses, seconds, per_second, ns, hit_rate);
+    } else {
+        printf("%-12s parse    %8s %-3s %-3s %12.1f %10.2f %9s\n", pattern_names[pattern], "-", "-", "-",
+               per_second / 1e6, ns, "-");
+        fprintf(csv, "%s,parse,,,,,,%" PRIu64 ",%.9f,%.0f,%.3f,\n", pattern_names[pattern], accesses, seconds,
+                per_second, ns);
+    }
+}
+
+int main(int argc, char **argv) {
+    pattern_config_t patterns = {.accesses = 1u << 22, .footprint = 1u << 20, .stride = 256, .zipf_exponent = 0.99,
+                                 .seed = 1};
+    cache_config_t base = DEFAULT_CONFIG;
+    char pattern_list[] = "sequential,strided,uniform,zipf,interleaved";
+    char size_list[] = "1024,4096,32768";
+    char mapping_list[] = "dm,fa,sa";
+    char org_list[] = "uc,sc";
+    char *lists[4] = {pattern_list, size_list, mapping_list, org_list};
+    unsigned int repeat = 3;
+    const char *output_path = "cache_bench.csv";
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            printf("Usage: ./cache_bench [options]\n"
+                   "Options:\n"
+                   "  --patterns LIST   sequential,strided,uniform,zipf,interleaved (default all of them)\n"
+                   "  --sizes LIST      cache sizes in bytes (default 1024,4096,32768)\n"
+                   "  --mappings LIST   cache mappings: dm,fa,sa (default dm,fa,sa)\n"
+                   "  --orgs LIST       cache organizations: uc,sc (default uc,sc)\n"
+                   "  --ways N          ways of a set associative cache (default 4)\n"
+                   "  --policy P        replacement policy: fifo|lru|plru|random (default fifo)\n"
+                   "  --accesses N      accesses per trace (default 4194304)\n"
+                   "  --footprint BYTES bytes touched by the data accesses (default 1048576)\n"
+                   "  --stride BYTES    stride of the strided pattern (default 256)\n"
+                   "  --zipf S          exponent of the zipf pattern (default 0.99)\n"
+                   "  --seed N          seed of the random patterns (default 1)\n"
+                   "  --repeat R        report the best of R runs (default 3)\n"
+                   "  --output PATH     CSV file of the results (default cache_bench.csv)\n");
+            exit(0);
+        }
+        const char *option = argv[i];
+        char *value = argv[++i];
+        if (strcmp(option, "--patterns") == 0) {
+            lists[0] = value;
+        } else if (strcmp(option, "--sizes") == 0) {
+            lists[1] = value;
+        } else if (strcmp(option, "--mappings") == 0) {
+            lists[2] = value;
+        } else if (strcmp(option, "--orgs") == 0) {
+            lists[3] = value;
+        } else if (strcmp(option, "--ways") == 0) {
+            base.ways = (uint32_t) atoi(value);
+        } else if (strcmp(option, "--policy") == 0) {
+            if (parse_policy(value, &base.policy)) {
+                printf("Unknown replacement policy %s\n", value);
+                exit(0);
+            }
+        } else if (strcmp(option, "--accesses") == 0) {
+            patterns.accesses = strtoull(value, NULL, 0);
+        } else if (strcmp(option, "--footprint") == 0) {
+            patterns.footprint = (uint32_t) strtoul(value, NULL, 0);
+        } else if (strcmp(option, "--stride") == 0) {
+            patterns.stride = (uint32_t) strtoul(value, NULL, 0);
+        } else if (strcmp(option, "--zipf") == 0) {
+            patterns.zipf_exponent = atof(value);
+        } else if (strcmp(option, "--seed") == 0) {
+            patterns.seed = strtoull(value, NULL, 0);
+        } else if (strcmp(option, "--repeat") == 0) {
+            repeat = (unsigned int) atoi(value);
+        } else if (strcmp(option, "--output") == 0) {
+            output_path = value;
+        } else {
+            printf("Unknown option %s\n", option);
+            exit(0);
+        }
+    }
+    if (patterns.accesses == 0 || repeat == 0) {
+        printf("The number of accesses and repetitions must be positive\n");
+        exit(0);
+    }
+    if (patterns.footprint < DEFAULT_BLOCK_SIZE || patterns.footprint > MAX_FOOTPRINT) {
+        printf("The footprint must be between %d and %u bytes\n", DEFAULT_BLOCK_SIZE, MAX_FOOTPRINT);
+        exit(0);
+    }
+
+    /* the lists, every configuration is checked before anything is timed */
+    char *pattern_items[PATTERN_COUNT];
+    char *size_items[32], *mapping_items[3], *org_items[2];
+    unsigned int pattern_count = split_list(lists[0], pattern_items, PATTERN_COUNT);
+    unsigned int size_count = split_list(lists[1], size_items, 32);
+    unsigned int mapping_count = split_list(lists[2], mapping_items, 3);
+    unsigned int org_count = split_list(lists[3], org_items, 2);
+    if (pattern_count > PATTERN_COUNT || size_count > 32 || mapping_count > 3 || org_count > 2) {
+        printf("Too many list items\n");
+        exit(0);
+    }
+    pattern_t selected[PATTERN_COUNT];
+    for (unsigned int p = 0; p < pattern_count; p++) {
+        unsigned int n = 0;
+        while (n < PATTERN_COUNT && strcmp(pattern_items[p], pattern_names[n]) != 0) {
+            n++;
+        }
+        if (n == PATTERN_COUNT) {
+            printf("Unknown pattern %s\n", pattern_items[p]);
+            exit(0);
+        }
+        selected[p] = (pattern_t) n;
+    }
+    unsigned int config_count = size_count * mapping_count * org_count;
+    cache_config_t *configs = malloc(config_count * sizeof(cache_config_t));
+    for (unsigned int i = 0; i < config_count; i++) {
+        const char *size_name = size_items[i / (mapping_count * org_count)];
+        const char *mapping_name = mapping_items[(i / org_count) % mapping_count];
+        const char *org_name = org_items[i % org_count];
+        configs[i] = base;
+        configs[i].cache_size = (uint32_t) atoi(size_name);
+        const char *problem = NULL;
+        if (parse_mapping(mapping_name, &configs[i].mapping) || parse_org(org_name, &configs[i].org) ||
+            (problem = validate_config(&configs[i]))) {
+            printf("Invalid configuration %s %s %s%s%s\n", size_name, mapping_name, org_name, problem ? ": " : "",
+                   problem ? problem : "");
+            exit(0);
+        }
+    }
+
+    FILE *csv = fopen(output_path, "w");
+    if (!csv) {
+        printf("Unable to create %s\n", output_path);
+        exit(1);
+    }
+    char trace_path[] = "/tmp/cache_bench_XXXXXX";
+    int fd = mkstemp(trace_path);
+    if (fd < 0) {
+        printf("Unable to create a temporary trace file\n");
+        exit(1);
+    }
+    close(fd);
+
+    fprintf(csv, "pattern,phase,size,mapping,organization,ways,policy,accesses,seconds,accesses_per_s,"
+                 "ns_per_access,hit_rate\n");
+    printf("%" PRIu64 " accesses per trace, %" PRIu32 " byte footprint, best of %u runs\n", patterns.accesses,
+           patterns.footprint, repeat);
+    printf("%-12s %-8s %8s %-3s %-3s %12s %10s %9s\n", "pattern", "phase", "size", "map", "org", "M accesses/s",
+           "ns/access", "hit rate");
+    int failed = 0;
+    for (unsigned int p = 0; p < pattern_count && !failed; p++) {
+        mem_access_t *accesses = generate_pattern(selected[p], &patterns);
+
+        double seconds = -1;
+        if (write_text_trace(trace_path, accesses, patterns.accesses) == 0) {
+            seconds = time_parse(trace_path, patterns.accesses, repeat);
+        }
+        if (seconds < 0) {
+            printf("Unable to write and parse the %s trace in %s\n", pattern_names[selected[p]], trace_path);
+            failed = 1;
+        } else {
+            report(csv, selected[p], NULL, patterns.accesses, seconds, NULL);
+        }
+
+        for (unsigned int i = 0; i < config_count && !failed; i++) {
+            cache_stat_t stats;
+            seconds = time_simulation(&configs[i], accesses, patterns.accesses, repeat, &stats);
+            report(csv, selected[p], &configs[i], patterns.accesses, seconds, &stats);
+        }
+        free(accesses);
+    }
+    unlink(trace_path);
+    free(configs);
+
+    int write_failed = ferror(csv);
+    if (fclose(csv) != 0 || write_failed) {
+        printf("Unable to write %s\n", output_path);
+        exit(1);
+    }
+    return failed;
+}
@@ -1,251 +1,1630 @@
-#include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
-typedef enum {
-    dm, fa
-} cache_map_t;
-typedef enum {
-    uc, sc
-} cache_org_t;
-typedef enum {
-    instruction, data
-} access_t;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
+#include "cachesim.h"
+#include "trace.h"
+
+/* Buffers shared between threads are aligned to host cache lines */
+#define CACHE_LINE_SIZE 64
+
+/* Allocates zero or more bytes aligned to a host cache line */
+static void *alloc_aligned(size_t size) {
+    size = (size + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+    return aligned_alloc(CACHE_LINE_SIZE, size ? size : CACHE_LINE_SIZE);
+}
+
+/**
+ * Stops the program if a trace ended early because it could not be read or decompressed
+ * @param trace trace whose reads have returned 0
+ */
+void check_trace(const trace_t *trace) {
+    const char *error = trace_error(trace);
+    if (error) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+}
+
+/**
+ * Parses the whole trace without simulating it and prints the parse throughput
+ *
+ * The trace is rewound afterwards
+ * @param trace trace to parse
+ */
+void report_parse_throughput(trace_t *trace) {
+    struct timespec start, stop;
+    mem_access_t access;
+    uint64_t count = 0;
+    uint32_t checksum = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (read_transaction(trace, &access)) {
+        checksum ^= access.address;
+        count++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    check_trace(trace);
+    rewind_trace(trace);
+
+    double seconds = (double) (stop.tv_sec - start.tv_sec) + (double) (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    fprintf(stderr, "Parsed %" PRIu64 " accesses (%zu bytes, checksum %08" PRIx32 ") in %.3f ms: %.1f MB/s\n",
+            count, trace_size(trace), checksum, seconds * 1e3, (double) trace_size(trace) / 1e6 / seconds);
+}
+
+/* Run filter
+ *
+ * An access to the block that its cache accessed last is a hit that changes no replacement state
+ * under any policy: the block already is the most recently used block of its set. The filter merges
+ * such accesses into the record of the previous access as repeats, which are counted as hits
+ * without being simulated. A unified cache sees every access, so only the previous record takes
+ * repeats, while each half of a split cache only sees its own stream, so the previous record of
+ * the same stream does.
+ */
 typedef struct {
-    uint32_t address;
-    access_t accesstype;
-} mem_access_t;
+    cache_org_t org;
+    unsigned int offset_bits;
+    int64_t last[2];    // record of the previous access per cache, -1 if none
+} run_filter_t;
+
+/**
+ * Prepares a run filter for the first batch
+ * @param filter filter to initialise
+ * @param config configuration of the simulated caches
+ */
+void init_run_filter(run_filter_t *filter, const cache_config_t *config) {
+    filter->org = config->org;
+    filter->offset_bits = (unsigned int) __builtin_ctz(config->block_size);
+    filter->last[instruction] = -1;
+    filter->last[data] = -1;
+}
+
+/**
+ * Checks whether run filtering leaves the statistics of a configuration unchanged
+ *
+ * Inclusive hierarchies apply back invalidations at the end of each batch, so their
+ * statistics depend on how many accesses a batch holds
+ * @param config configuration of the simulated caches
+ * @return 1 if the accesses may be filtered
+ */
+int run_filter_exact(const cache_config_t *config) {
+    return config->level_sizes[0] == 0 || config->inclusion == exclusive;
+}
+
+/**
+ * Merges the access at records[count] into the previous record of its cache if both access the same block
+ * @param filter the run filter, records before its previous records may not change
+ * @param records records of the current batch
+ * @param count index of the access, which has been appended to records
+ * @return 1 if the access was merged, 0 if it is a new record
+ */
+static inline int filter_access(run_filter_t *filter, mem_access_t *records, uint64_t count) {
+    int stream = filter->org == uc ? 0 : records[count].accesstype;
+    int64_t last = filter->last[stream];
+    if (last >= 0 && ((records[last].address ^ records[count].address) >> filter->offset_bits) == 0) {
+        records[last].repeats++;
+        return 1;
+    }
+    filter->last[stream] = (int64_t) count;
+    return 0;
+}
+
+/**
+ * Filters accesses that have been read into memory
+ * @param accesses accesses in trace order
+ * @param count number of accesses
+ * @param config configuration of the simulated caches
+ * @param filtered_count set to the number of records
+ * @return array of <filtered_count> records, to be freed by the caller
+ */
+mem_access_t *filter_trace(const mem_access_t *accesses, uint64_t count, const cache_config_t *config,
+                           uint64_t *filtered_count) {
+    run_filter_t filter;
+    init_run_filter(&filter, config);
+    mem_access_t *records = malloc((count ? count : 1) * sizeof(mem_access_t));
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        records[n] = accesses[i];
+        n += !filter_access(&filter, records, n);
+    }
+    *filtered_count = n;
+    return records;
+}
+
+/* Reader pipeline
+ *
+ * A reader thread parses the trace into a ring of batches while the simulation consumes them.
+ * The ring has a single producer and a single consumer, so the two counters are all the
+ * synchronization that is needed: the reader fills batch produced % PIPELINE_DEPTH while
+ * produced - consumed < PIPELINE_DEPTH, the simulation reads batch consumed % PIPELINE_DEPTH
+ * while consumed < produced.
+ *
+ * Batches also end after every interval of statistics and after the warm-up window, so the
+ * statistics can be taken between two batches.
+ */
+#define PIPELINE_DEPTH 8
 
 typedef struct {
-    uint64_t accesses;
-    uint64_t hits;
-    // You can declare additional statistics if
-    // you like, however you are now allowed to
-    // remove the accesses or hits
-} cache_stat_t;
+    mem_access_t accesses[ACCESS_BATCH_SIZE];
+    uint64_t count;
+    int last;           // the trace ends with this batch
+    uint64_t read;      // accesses read from the trace up to the end of this batch
+    trace_position_t position;  // position of the trace after this batch
+} access_batch_t;
 
 typedef struct {
-    uint64_t *tags;
-    uint64_t *valid_tags;
-    uint64_t fifo_pointer;
-    uint64_t block_count;
-} cache_t;
-
-// DECLARE CACHES AND COUNTERS FOR THE STATS HERE
-
-uint32_t cache_size;
-uint32_t block_size = 64;
-cache_map_t cache_mapping;
-cache_org_t cache_org;
-
-// USE THIS FOR YOUR CACHE STATISTICS
-cache_stat_t cache_statistics;
-
-/* Reads a memory access from the trace file and returns
- * 1) access type (instruction or data access
- * 2) memory address
- */
-mem_access_t read_transaction(FILE *ptr_file) {
-    char buf[1000];
-    char *token;
-    char *string = buf;
-    mem_access_t access;
+    trace_t *trace;
+    access_batch_t *batches;
+    int filtered;
+    run_filter_t filter;
+    uint64_t interval;  // accesses per interval of statistics, 0 without intervals
+    uint64_t warmup;    // accesses of the warm-up window, 0 without warm-up
+    const set_sample_t *sample; // sampled sets, NULL to pass every access on
+    uint64_t start;     // accesses read before the pipeline started, when resuming a checkpoint
+    pthread_t reader;
+    /* written by one thread each, kept on separate host cache lines */
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t produced;
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t consumed;
+} pipeline_t;
+
+/* Waits a little longer on every call, spinning first and then sleeping */
+static void backoff(unsigned int *attempts) {
+    if (*attempts < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    } else if (*attempts < 128) {
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+    (*attempts)++;
+}
 
-    if (fgets(buf, 1000, ptr_file) != NULL) {
-        /* Get the access type */
-        token = strsep(&string, " \n");
-        if (strcmp(token, "I") == 0) {
-            access.accesstype = instruction;
-        } else if (strcmp(token, "D") == 0) {
-            access.accesstype = data;
+/* Number of accesses after which the next batch has to end */
+static uint64_t next_boundary(const pipeline_t *pipeline, uint64_t accesses) {
+    uint64_t boundary = UINT64_MAX;
+    if (pipeline->interval) {
+        boundary = (accesses / pipeline->interval + 1) * pipeline->interval;
+    }
+    if (pipeline->warmup > accesses && pipeline->warmup < boundary) {
+        boundary = pipeline->warmup;
+    }
+    return boundary;
+}
+
+static void *pipeline_reader(void *arg) {
+    pipeline_t *pipeline = arg;
+    uint64_t produced = 0;
+    uint64_t accesses = pipeline->start;
+    uint64_t boundary = next_boundary(pipeline, accesses);
+    int last = 0;
+    do {
+        unsigned int attempts = 0;
+        while (produced - atomic_load_explicit(&pipeline->consumed, memory_order_acquire) == PIPELINE_DEPTH) {
+            backoff(&attempts);
+        }
+        access_batch_t *batch = &pipeline->batches[produced % PIPELINE_DEPTH];
+        /* records of the previous batch belong to the simulation now */
+        pipeline->filter.last[instruction] = -1;
+        pipeline->filter.last[data] = -1;
+        uint64_t count = 0;
+        while (count < ACCESS_BATCH_SIZE) {
+            if (!read_transaction(pipeline->trace, &batch->accesses[count])) {
+                last = 1;
+                break;
+            }
+            if (pipeline->sample && !sample_access(pipeline->sample, batch->accesses[count].address)) {
+                /* accesses to sets outside the sample are dropped as soon as they are decoded */
+            } else if (!pipeline->filtered || !filter_access(&pipeline->filter, batch->accesses, count)) {
+                count++;
+            }
+            if (++accesses == boundary) {
+                boundary = next_boundary(pipeline, accesses);
+                break;
+            }
+        }
+        batch->count = count;
+        batch->last = last;
+        batch->read = accesses;
+        get_trace_position(pipeline->trace, &batch->position);
+        atomic_store_explicit(&pipeline->produced, ++produced, memory_order_release);
+    } while (!last);
+    return NULL;
+}
+
+/**
+ * Starts a reader thread that parses the remaining accesses of a trace into batches
+ * @param trace trace to read, owned by the reader thread until stop_pipeline
+ * @param filter run filter applied to the accesses, NULL to pass every access on
+ * @param interval accesses per interval of statistics, 0 without intervals
+ * @param warmup accesses of the warm-up window, 0 without warm-up
+ * @param sample sampled sets, NULL to pass every access on
+ * @param start accesses that have already been read from the trace, 0 unless a checkpoint is resumed
+ * @return the pipeline, to be stopped with stop_pipeline
+ */
+pipeline_t *start_pipeline(trace_t *trace, const run_filter_t *filter, uint64_t interval, uint64_t warmup,
+                           const set_sample_t *sample, uint64_t start) {
+    pipeline_t *pipeline = alloc_aligned(sizeof(pipeline_t));
+    pipeline->trace = trace;
+    pipeline->interval = interval;
+    pipeline->warmup = warmup;
+    pipeline->sample = sample;
+    pipeline->start = start;
+    pipeline->filtered = filter != NULL;
+    if (filter) {
+        pipeline->filter = *filter;
+    }
+    pipeline->batches = malloc(PIPELINE_DEPTH * sizeof(access_batch_t));
+    atomic_init(&pipeline->produced, 0);
+    atomic_init(&pipeline->consumed, 0);
+    pthread_create(&pipeline->reader, NULL, pipeline_reader, pipeline);
+    return pipeline;
+}
+
+/**
+ * Waits for the next batch of accesses
+ * @param pipeline the pipeline
+ * @return the batch, valid until release_batch is called
+ */
+const access_batch_t *next_batch(pipeline_t *pipeline) {
+    uint64_t consumed = atomic_load_explicit(&pipeline->consumed, memory_order_relaxed);
+    unsigned int attempts = 0;
+    while (atomic_load_explicit(&pipeline->produced, memory_order_acquire) == consumed) {
+        backoff(&attempts);
+    }
+    return &pipeline->batches[consumed % PIPELINE_DEPTH];
+}
+
+/**
+ * Hands the batch returned by next_batch back to the reader thread
+ * @param pipeline the pipeline
+ */
+void release_batch(pipeline_t *pipeline) {
+    atomic_fetch_add_explicit(&pipeline->consumed, 1, memory_order_release);
+}
+
+/**
+ * Waits for the reader thread to finish and frees the pipeline, the trace is not closed
+ * @param pipeline pipeline whose last batch has been consumed
+ */
+void stop_pipeline(pipeline_t *pipeline) {
+    pthread_join(pipeline->reader, NULL);
+    free(pipeline->batches);
+    free(pipeline);
+}
+
+/* Interval statistics
+ *
+ * The simulation pushes a snapshot into a ring after every interval, a writer thread turns the
+ * differences of consecutive snapshots into CSV rows with one row per cache. The ring is a single
+ * producer, single consumer ring like the reader pipeline.
+ */
+#define INTERVAL_RING_SIZE 256
+
+typedef struct {
+    FILE *file;
+    cache_org_t org;
+    unsigned int level_count;
+    stat_snapshot_t *snapshots;
+    pthread_t writer;
+    atomic_int finished;    // no more snapshots follow
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t produced;
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t consumed;
+} interval_log_t;
+
+static void write_interval_row(FILE *file, uint64_t end, const char *cache, const cache_stat_t *now,
+                               const cache_stat_t *before) {
+    cache_stat_t stats = *now;
+    subtract_statistics(&stats, before);
+    fprintf(file, "%" PRIu64 ",%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f\n", end, cache, stats.accesses, stats.hits,
+            stats.evicts, stats.accesses ? (double) stats.hits / stats.accesses : 0.0);
+}
+
+static void *interval_writer(void *arg) {
+    static const char *const level_names[] = {"L2", "L3"};
+    interval_log_t *log = arg;
+    stat_snapshot_t previous;
+    memset(&previous, 0, sizeof(previous));
+    uint64_t consumed = 0;
+    while (1) {
+        unsigned int attempts = 0;
+        while (atomic_load_explicit(&log->produced, memory_order_acquire) == consumed) {
+            /* finished is set after the last snapshot has been produced */
+            if (atomic_load(&log->finished) && atomic_load(&log->produced) == consumed) {
+                return NULL;
+            }
+            backoff(&attempts);
+        }
+        const stat_snapshot_t *snapshot = &log->snapshots[consumed % INTERVAL_RING_SIZE];
+        if (log->org == uc) {
+            write_interval_row(log->file, snapshot->accesses, "uc", &snapshot->caches[instruction],
+                               &previous.caches[instruction]);
         } else {
-            printf("Unkown access type\n");
-            exit(0);
+            write_interval_row(log->file, snapshot->accesses, "I", &snapshot->caches[instruction],
+                               &previous.caches[instruction]);
+            write_interval_row(log->file, snapshot->accesses, "D", &snapshot->caches[data], &previous.caches[data]);
         }
+        for (unsigned int level = 1; level < log->level_count; level++) {
+            write_interval_row(log->file, snapshot->accesses, level_names[level - 1], &snapshot->levels[level - 1],
+                               &previous.levels[level - 1]);
+        }
+        previous = *snapshot;
+        atomic_store_explicit(&log->consumed, ++consumed, memory_order_release);
+    }
+}
 
-        /* Get the access type */
-        token = strsep(&string, " \n");
-        access.address = (uint32_t) strtol(token, NULL, 16);
+/**
+ * Creates the interval statistics file of a simulation and starts its writer thread
+ * @param path path of the CSV file
+ * @param sim the simulation
+ * @return the interval log or NULL if the file could not be created
+ */
+interval_log_t *open_interval_log(const char *path, const simulation_t *sim) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return NULL;
+    }
+    fprintf(file, "access,cache,accesses,hits,evicts,hit_rate\n");
+    interval_log_t *log = alloc_aligned(sizeof(interval_log_t));
+    log->file = file;
+    log->org = simulation_config(sim)->org;
+    log->level_count = simulation_levels(sim);
+    log->snapshots = malloc(INTERVAL_RING_SIZE * sizeof(stat_snapshot_t));
+    atomic_init(&log->finished, 0);
+    atomic_init(&log->produced, 0);
+    atomic_init(&log->consumed, 0);
+    pthread_create(&log->writer, NULL, interval_writer, log);
+    return log;
+}
 
-        return access;
+/**
+ * Queues the statistics of the interval that ends at the current access
+ * @param log the interval log
+ * @param sim the simulation
+ */
+void log_interval(interval_log_t *log, const simulation_t *sim) {
+    uint64_t produced = atomic_load_explicit(&log->produced, memory_order_relaxed);
+    unsigned int attempts = 0;
+    while (produced - atomic_load_explicit(&log->consumed, memory_order_acquire) == INTERVAL_RING_SIZE) {
+        backoff(&attempts);
     }
+    take_snapshot(sim, &log->snapshots[produced % INTERVAL_RING_SIZE]);
+    atomic_store_explicit(&log->produced, produced + 1, memory_order_release);
+}
 
-    /* If there are no more entries in the file,
-     * return an address 0 that will terminate the infinite loop in main
-     */
-    access.address = 0;
-    return access;
+/**
+ * Waits for the writer thread to write all queued intervals and closes the file
+ * @param log the interval log
+ * @return 0 on success, 1 if the file could not be written
+ */
+int close_interval_log(interval_log_t *log) {
+    atomic_store(&log->finished, 1);
+    pthread_join(log->writer, NULL);
+    int failed = ferror(log->file);
+    failed |= fclose(log->file) != 0;
+    free(log->snapshots);
+    free(log);
+    return failed;
+}
+
+/* Checkpoints
+ *
+ * A checkpoint file holds a header with the position of the trace and the warm-up state of the run,
+ * followed by the image of the simulation (see save_simulation). Between two batches the simulation
+ * copies the header and its image into a buffer, then a writer thread writes the copy to a temporary
+ * file that replaces the checkpoint once it is complete, so a killed run keeps its previous checkpoint.
+ */
+#define CHECKPOINT_MAGIC "CSIMCKP1"
+#define CHECKPOINT_MAGIC_LEN 8
+
+/* Accesses between two checkpoints unless --checkpoint-every is given */
+#define DEFAULT_CHECKPOINT_EVERY 100000000
+
+typedef struct {
+    char magic[CHECKPOINT_MAGIC_LEN];
+    uint64_t accesses;          // accesses read from the trace
+    trace_position_t position;  // position of the next access of the trace
+    uint64_t warmed_up;         // the warm-up window has ended, warmup holds the snapshot at its end
+    stat_snapshot_t warmup;
+} checkpoint_header_t;
+
+typedef struct {
+    const char *path;
+    char *temp_path;
+    char *data;                 // header and image of the checkpoint that is written
+    size_t size;
+    pthread_t writer;
+    int writing;                // the writer thread has not been joined yet
+    int failed;                 // a checkpoint could not be written
+} checkpoint_writer_t;
+
+static void *checkpoint_writer(void *arg) {
+    checkpoint_writer_t *checkpoints = arg;
+    FILE *file = fopen(checkpoints->temp_path, "wb");
+    if (!file) {
+        checkpoints->failed = 1;
+        return NULL;
+    }
+    int failed = fwrite(checkpoints->data, 1, checkpoints->size, file) != checkpoints->size;
+    failed |= fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed |= fclose(file) != 0;
+    /* rename replaces the previous checkpoint atomically */
+    if (failed || rename(checkpoints->temp_path, checkpoints->path) != 0) {
+        remove(checkpoints->temp_path);
+        checkpoints->failed = 1;
+    }
+    return NULL;
+}
+
+/**
+ * Prepares writing checkpoints of a simulation
+ * @param path path of the checkpoint file
+ * @param sim the simulation
+ * @return the checkpoint writer
+ */
+checkpoint_writer_t *open_checkpoints(const char *path, const simulation_t *sim) {
+    checkpoint_writer_t *checkpoints = calloc(1, sizeof(checkpoint_writer_t));
+    checkpoints->path = path;
+    checkpoints->temp_path = malloc(strlen(path) + 5);
+    sprintf(checkpoints->temp_path, "%s.tmp", path);
+    checkpoints->size = sizeof(checkpoint_header_t) + simulation_image_size(sim);
+    checkpoints->data = malloc(checkpoints->size);
+    return checkpoints;
+}
+
+/**
+ * Copies the state of the run and starts writing it in the background
+ *
+ * Only waits if the previous checkpoint is still being written.
+ * @param checkpoints the checkpoint writer
+ * @param sim the simulation, between two batches
+ * @param header position of the trace and warm-up state of the run
+ */
+void write_checkpoint(checkpoint_writer_t *checkpoints, const simulation_t *sim, const checkpoint_header_t *header) {
+    if (checkpoints->writing) {
+        pthread_join(checkpoints->writer, NULL);
+    }
+    memcpy(checkpoints->data, header, sizeof(checkpoint_header_t));
+    memcpy(checkpoints->data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN);
+    save_simulation(sim, checkpoints->data + sizeof(checkpoint_header_t));
+    pthread_create(&checkpoints->writer, NULL, checkpoint_writer, checkpoints);
+    checkpoints->writing = 1;
+}
+
+/**
+ * Waits for the last checkpoint to be written and frees the writer
+ * @param checkpoints the checkpoint writer
+ * @return 0 on success, 1 if a checkpoint could not be written
+ */
+int close_checkpoints(checkpoint_writer_t *checkpoints) {
+    if (checkpoints->writing) {
+        pthread_join(checkpoints->writer, NULL);
+    }
+    int failed = checkpoints->failed;
+    free(checkpoints->data);
+    free(checkpoints->temp_path);
+    free(checkpoints);
+    return failed;
+}
+
+/**
+ * Restores a simulation from a checkpoint file
+ * @param path path of the checkpoint file
+ * @param sim simulation of the configuration the checkpoint was taken with
+ * @param header set to the header of the checkpoint
+ * @return NULL on success, otherwise a description of the problem
+ */
+const char *load_checkpoint(const char *path, simulation_t *sim, checkpoint_header_t *header) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return "unable to open the file";
+    }
+    char *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t n;
+    do {
+        if (size == capacity) {
+            capacity = capacity ? 2 * capacity : 1 << 20;
+            data = realloc(data, capacity);
+        }
+        n = fread(data + size, 1, capacity - size, file);
+        size += n;
+    } while (n > 0);
+    int failed = ferror(file);
+    fclose(file);
+    if (failed) {
+        free(data);
+        return "unable to read the file";
+    }
+    if (size < sizeof(checkpoint_header_t) || memcmp(data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0) {
+        free(data);
+        return "not a checkpoint";
+    }
+    memcpy(header, data, sizeof(checkpoint_header_t));
+    const char *problem = restore_simulation(sim, data + sizeof(checkpoint_header_t), size - sizeof(checkpoint_header_t));
+    free(data);
+    return problem;
+}
+
+/* Parses a comma separated list of the latencies of every level and the memory, returns 0 on success */
+int parse_latencies(const char *list, uint32_t latencies[MAX_LEVELS + 1]) {
+    const char *c = list;
+    for (int i = 0; i <= MAX_LEVELS; i++) {
+        char *end;
+        latencies[i] = (uint32_t) strtoul(c, &end, 10);
+        if (end == c || *end != (i == MAX_LEVELS ? '\0' : ',')) {
+            return 1;
+        }
+        c = end + 1;
+    }
+    return 0;
+}
+
+/**
+ * Parses an option that changes the cache configuration (--ways, --policy or one of the hierarchy options)
+ * @param argc number of arguments
+ * @param argv arguments
+ * @param i position of the option, advanced past its value
+ * @param config configuration to change
+ * @return 0 on success, 1 if the option is unknown or has an invalid value
+ */
+int parse_cache_option(int argc, char **argv, int *i, cache_config_t *config) {
+    const char *option = argv[*i];
+    if (*i + 1 >= argc) {
+        printf("Unknown option %s\n", option);
+        return 1;
+    }
+    const char *value = argv[++*i];
+    if (strcmp(option, "--ways") == 0) {
+        config->ways = (uint32_t) atoi(value);
+    } else if (strcmp(option, "--policy") == 0) {
+        if (parse_policy(value, &config->policy)) {
+            printf("Unknown replacement policy %s\n", value);
+            return 1;
+        }
+    } else if (strcmp(option, "--l2") == 0 || strcmp(option, "--l3") == 0) {
+        config->level_sizes[option[3] - '2'] = (uint32_t) atoi(value);
+    } else if (strcmp(option, "--l2-ways") == 0 || strcmp(option, "--l3-ways") == 0) {
+        config->level_ways[option[3] - '2'] = (uint32_t) atoi(value);
+    } else if (strcmp(option, "--inclusion") == 0) {
+        if (parse_inclusion(value, &config->inclusion)) {
+            printf("Unknown inclusion policy %s\n", value);
+            return 1;
+        }
+    } else if (strcmp(option, "--latency") == 0) {
+        if (parse_latencies(value, config->latencies)) {
+            printf("Expected %d comma separated latencies\n", MAX_LEVELS + 1);
+            return 1;
+        }
+    } else {
+        printf("Unknown option %s\n", option);
+        return 1;
+    }
+    return 0;
 }
 
 /**
- * Initialises a cache based on the block count
+ * Prints the geometry of the simulated caches
+ * @param sim the simulation
+ */
+void print_cache_organization(const simulation_t *sim) {
+    static const char *const mapping_descriptions[] = {
+            [dm] = "direct mapped", [fa] = "fully associative", [sa] = "set associative"};
+    static const char *const policy_descriptions[] = {[fifo] = "FIFO", [lru] = "LRU", [plru] = "PLRU", [rnd] = "Random"};
+    const cache_config_t *config = simulation_config(sim);
+    cache_info_t cache = get_cache_info(sim, 0, instruction);
+
+    printf("\nCache Organization\n");
+    printf("------------------\n");
+    if (config->org == uc) {
+        printf("Size:           %" PRIu32 " bytes\n", config->cache_size);
+    } else {
+        printf("Size:           %" PRIu32 "/%" PRIu32 " bytes\n", config->cache_size / 2, config->cache_size / 2);
+    }
+    printf("Mapping:        %s\n", mapping_descriptions[config->mapping]);
+    printf("Organization:   %s\n", config->org == uc ? "unified cache" : "split cache");
+    printf("Policy:         %s\n", policy_descriptions[config->policy]);
+    printf("Block Size:     %" PRIu32 " bytes\n", config->block_size);
+    printf("Number of Sets: %" PRIu64 "\n", cache.set_count);
+    printf("Number of Ways: %" PRIu32 "\n", cache.ways);
+    printf("Block Offset:   %u bits\n", cache.offset_bits);
+    printf("Index:          %u bits\n", cache.set_bits);
+    printf("Tag:            %u bits\n", cache.tag_bits);
+    for (unsigned int level = 1; level < simulation_levels(sim); level++) {
+        cache_info_t lower = get_cache_info(sim, level, instruction);
+        printf("L%u:             %" PRIu32 " bytes, %" PRIu64 " sets, %" PRIu32 " ways\n", level + 1,
+               config->level_sizes[level - 1], lower.set_count, lower.ways);
+    }
+    if (simulation_levels(sim) > 1) {
+        printf("Inclusion:      %s\n", inclusion_names[config->inclusion]);
+    }
+    printf("------------------\n");
+}
+
+static void print_miss_classes(const char *prefix, const cache_stat_t *stats) {
+    int64_t conflict = (int64_t) (stats->accesses - stats->hits - stats->compulsory - stats->capacity);
+    printf("%sCompulsory: %" PRIu64 "\n", prefix, stats->compulsory);
+    printf("%sCapacity:   %" PRIu64 "\n", prefix, stats->capacity);
+    printf("%sConflict:   %" PRId64 "\n", prefix, conflict);
+}
+
+/**
+ * Prints the statistics that are not part of the standard output: evictions, the statistics
+ * of each half of a split cache and the lower levels and average memory access time of a hierarchy
+ * @param sim the simulation
+ */
+void print_extended_statistics(const simulation_t *sim) {
+    const cache_config_t *config = simulation_config(sim);
+    cache_stat_t statistics = simulation_statistics(sim);
+    printf("Evicts:   %" PRIu64 "\n", statistics.evicts);
+    if (config->classify && config->org == uc) {
+        print_miss_classes("", &statistics);
+    }
+    if (config->org == sc) {
+        static const char *const prefixes[] = {[instruction] = "ICache", [data] = "DCache"};
+        static const access_t order[] = {data, instruction};
+        for (int i = 0; i < 2; i++) {
+            cache_stat_t stats = get_cache_info(sim, 0, order[i]).statistics;
+            printf("\n");
+            printf("%s Accesses: %" PRIu64 "\n", prefixes[order[i]], stats.accesses);
+            printf("%s Hits:     %" PRIu64 "\n", prefixes[order[i]], stats.hits);
+            printf("%s Evicts:   %" PRIu64 "\n", prefixes[order[i]], stats.evicts);
+            printf("%s Hit Rate: %.4f\n", prefixes[order[i]],
+                   stats.accesses ? (double) stats.hits / stats.accesses : 0.0);
+            if (config->classify) {
+                print_miss_classes(order[i] == instruction ? "ICache " : "DCache ", &stats);
+            }
+        }
+    }
+    for (unsigned int level = 1; level < simulation_levels(sim); level++) {
+        cache_stat_t stats = get_cache_info(sim, level, instruction).statistics;
+        printf("\n");
+        printf("L%u Accesses: %" PRIu64 "\n", level + 1, stats.accesses);
+        printf("L%u Hits:     %" PRIu64 "\n", level + 1, stats.hits);
+        printf("L%u Evicts:   %" PRIu64 "\n", level + 1, stats.evicts);
+        printf("L%u Hit Rate: %.4f\n", level + 1, stats.accesses ? (double) stats.hits / stats.accesses : 0.0);
+    }
+    if (simulation_levels(sim) > 1) {
+        printf("\nAMAT:     %.2f cycles\n", average_access_time(sim));
+    }
+    if (warmup_accesses(sim)) {
+        printf("\nWarm-up:  %" PRIu64 " accesses excluded\n", warmup_accesses(sim));
+    }
+    sample_estimate_t estimate;
+    if (get_sample_estimate(sim, &estimate)) {
+        printf("\nSampled:  %" PRIu64 " of %" PRIu64 " sets, counts are extrapolated\n", estimate.sampled_sets,
+               estimate.set_count);
+        if (isnan(estimate.margin)) {
+            printf("Estimate: hit rate %.4f, no confidence interval from a single set\n", estimate.hit_rate);
+        } else {
+            printf("Estimate: hit rate %.4f +- %.4f (95%% confidence)\n", estimate.hit_rate, estimate.margin);
+        }
+    }
+    printf("-----------------\n");
+}
+
+/* Configuration sweep
  *
- * The data blocks are ignored since they were not required by the assignment
- * @param block_count number of blocks
- * @return a cache with <block_count> blocks
+ * The trace is parsed once into memory and run filtered once per organization, every
+ * configuration is then simulated on its own simulation_t by a pool of worker threads.
  */
-cache_t *init_cache(uint64_t block_count) {
-    cache_t *cache = malloc(sizeof(cache_t));
-    cache->tags = malloc(block_count * sizeof(uint64_t));
-    cache->valid_tags = malloc(block_count * sizeof(uint64_t));
-    cache->fifo_pointer = 0;
-    cache->block_count = block_count;
-    for (uint64_t i = 0; i < block_count; i++) {
-        cache->valid_tags[i] = 0;
-        cache->tags[i] = 0;
+typedef struct {
+    const mem_access_t *accesses[2];    // records per organization
+    uint64_t access_count[2];
+    const cache_config_t *configs;
+    cache_stat_t *results;
+    uint64_t config_count;
+    atomic_uint_fast64_t next_config;
+} sweep_t;
+
+static void *sweep_worker(void *arg) {
+    sweep_t *sweep = arg;
+    uint64_t job;
+    while ((job = atomic_fetch_add(&sweep->next_config, 1)) < sweep->config_count) {
+        simulation_t *sim = init_simulation(&sweep->configs[job]);
+        cache_org_t org = sweep->configs[job].org;
+        simulate_accesses(sim, sweep->accesses[org], sweep->access_count[org]);
+        sweep->results[job] = simulation_statistics(sim);
+        free_simulation(sim);
     }
-    return cache;
+    return NULL;
+}
+
+/**
+ * Simulates every combination of the given cache sizes, mappings and organizations
+ * in parallel and prints the results as CSV
+ * @param trace trace to simulate
+ * @param sizes comma separated list of cache sizes
+ * @param mappings comma separated list of mappings (dm, fa, sa)
+ * @param orgs comma separated list of organizations (uc, sc)
+ * @param base ways and policy of all configurations
+ * @return 0 on success, 1 if a list could not be parsed
+ */
+int sweep_configurations(trace_t *trace, const char *sizes, const char *mappings, const char *orgs,
+                         const cache_config_t *base) {
+    const char *lists[3] = {sizes, mappings, orgs};
+    char *copies[3];
+    char **items[3];
+    uint64_t counts[3];
+    for (int l = 0; l < 3; l++) {
+        /* split the comma separated list in place */
+        copies[l] = strdup(lists[l]);
+        counts[l] = 1;
+        for (const char *c = copies[l]; *c; c++) {
+            counts[l] += *c == ',';
+        }
+        items[l] = malloc(counts[l] * sizeof(char *));
+        char *rest = copies[l];
+        for (uint64_t i = 0; i < counts[l]; i++) {
+            items[l][i] = strsep(&rest, ",");
+        }
+    }
+
+    /* build the cartesian product of the lists */
+    uint64_t config_count = counts[0] * counts[1] * counts[2];
+    cache_config_t *configs = malloc(config_count * sizeof(cache_config_t));
+    int failed = 0;
+    for (uint64_t i = 0; i < config_count && !failed; i++) {
+        const char *size_name = items[0][i / (counts[1] * counts[2])];
+        const char *mapping_name = items[1][(i / counts[2]) % counts[1]];
+        const char *org_name = items[2][i % counts[2]];
+        cache_config_t *config = &configs[i];
+        *config = *base;
+        config->cache_size = (uint32_t) atoi(size_name);
+        if (parse_mapping(mapping_name, &config->mapping) || parse_org(org_name, &config->org) ||
+            validate_config(config)) {
+            printf("Invalid configuration %s %s %s\n", size_name, mapping_name, org_name);
+            failed = 1;
+        }
+    }
+    for (int l = 0; l < 3; l++) {
+        free(items[l]);
+        free(copies[l]);
+    }
+    if (failed) {
+        free(configs);
+        return 1;
+    }
+
+    sweep_t sweep;
+    uint64_t access_count;
+    mem_access_t *accesses = load_trace(trace, &access_count);
+    check_trace(trace);
+    for (cache_org_t org = uc; org <= sc; org++) {
+        cache_config_t config = *base;
+        config.org = org;
+        if (run_filter_exact(&config)) {
+            sweep.accesses[org] = filter_trace(accesses, access_count, &config, &sweep.access_count[org]);
+        } else {
+            sweep.accesses[org] = accesses;
+            sweep.access_count[org] = access_count;
+        }
+    }
+    sweep.configs = configs;
+    sweep.config_count = config_count;
+    sweep.results = malloc(config_count * sizeof(cache_stat_t));
+    atomic_init(&sweep.next_config, 0);
+
+    /* one worker per core, but not more workers than configurations */
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t worker_count = cores > 0 ? (uint64_t) cores : 1;
+    if (worker_count > config_count) {
+        worker_count = config_count;
+    }
+    pthread_t *workers = malloc(worker_count * sizeof(pthread_t));
+    for (uint64_t w = 0; w < worker_count; w++) {
+        pthread_create(&workers[w], NULL, sweep_worker, &sweep);
+    }
+    for (uint64_t w = 0; w < worker_count; w++) {
+        pthread_join(workers[w], NULL);
+    }
+
+    printf("size,mapping,organization,ways,policy,accesses,hits,evicts,hit_rate\n");
+    for (uint64_t i = 0; i < config_count; i++) {
+        const cache_stat_t *stats = &sweep.results[i];
+        uint64_t block_count;
+        uint32_t ways;
+        cache_geometry(&configs[i], &block_count, &ways);
+        printf("%" PRIu32 ",%s,%s,%" PRIu32 ",%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f\n", configs[i].cache_size,
+               mapping_names[configs[i].mapping], org_names[configs[i].org], ways, policy_names[configs[i].policy],
+               stats->accesses, stats->hits, stats->evicts,
+               stats->accesses ? (double) stats->hits / stats->accesses : 0.0);
+    }
+
+    free(workers);
+    free(sweep.results);
+    for (cache_org_t org = uc; org <= sc; org++) {
+        if (sweep.accesses[org] != accesses) {
+            free((void *) sweep.accesses[org]);
+        }
+    }
+    free(accesses);
+    free(configs);
+    return 0;
+}
+
+/* Single pass profiling of all power of two cache sizes
+ *
+ * Fully associative LRU caches are profiled with stack (reuse) distances: the distance of an access is
+ * the number of distinct blocks touched since the previous access to the same block, and the access hits
+ * in every LRU cache with more blocks than that. The distance is counted with a fenwick tree over the access
+ * times that holds a 1 at the time of the latest access of every block. Once the tree is full the latest
+ * accesses are renumbered 1, 2, ... in their order, so the tree only grows with the number of distinct blocks
+ * and the trace is streamed instead of loaded.
+ * Direct mapped caches keep one block array per cache size, which are all updated on every access.
+ */
+#define EMPTY_BLOCK UINT32_MAX
+
+/* Open addressing hash map from block address to the time of its latest access */
+typedef struct {
+    uint32_t *blocks;
+    uint32_t *times;
+    uint64_t mask;
+    uint64_t count;
+} block_map_t;
+
+typedef struct {
+    uint32_t *fenwick;      // fenwick tree over the access times, 1-based
+    uint32_t *owners;       // block accessed at every time, 1-based
+    uint64_t length;        // number of times the tree can hold
+    uint64_t time;          // time of the latest access
+    block_map_t last_access;
+    uint64_t *histogram;    // histogram[d] = accesses with stack distance d, d < max_blocks
+    uint64_t max_blocks;
+} stack_profile_t;
+
+typedef struct {
+    unsigned int size_count;   // cache sizes 1, 2, 4, ... blocks
+    uint32_t **blocks;         // blocks[k] holds the block stored in each of the 2^k sets
+    uint64_t *hits;
+    uint64_t accesses;
+} dm_profile_t;
+
+static void init_block_map(block_map_t *map) {
+    map->mask = 1023;
+    map->count = 0;
+    map->blocks = malloc((map->mask + 1) * sizeof(uint32_t));
+    map->times = malloc((map->mask + 1) * sizeof(uint32_t));
+    memset(map->blocks, 0xff, (map->mask + 1) * sizeof(uint32_t));
+}
+
+static inline uint64_t block_map_home(const block_map_t *map, uint32_t block) {
+    return ((uint64_t) block * 0x9E3779B97F4A7C15ULL >> 32) & map->mask;
+}
+
+/* Returns the slot of block in the map, which is empty if the block was never accessed */
+static inline uint64_t block_map_slot(const block_map_t *map, uint32_t block) {
+    uint64_t pos = block_map_home(map, block);
+    while (map->blocks[pos] != block && map->blocks[pos] != EMPTY_BLOCK) {
+        pos = (pos + 1) & map->mask;
+    }
+    return pos;
+}
+
+/* Doubles the capacity of the map */
+static void grow_block_map(block_map_t *map) {
+    uint32_t *blocks = map->blocks;
+    uint32_t *times = map->times;
+    uint64_t old_size = map->mask + 1;
+    map->mask = 2 * old_size - 1;
+    map->blocks = malloc(2 * old_size * sizeof(uint32_t));
+    map->times = malloc(2 * old_size * sizeof(uint32_t));
+    memset(map->blocks, 0xff, 2 * old_size * sizeof(uint32_t));
+    for (uint64_t i = 0; i < old_size; i++) {
+        if (blocks[i] != EMPTY_BLOCK) {
+            uint64_t pos = block_map_slot(map, blocks[i]);
+            map->blocks[pos] = blocks[i];
+            map->times[pos] = times[i];
+        }
+    }
+    free(blocks);
+    free(times);
+}
+
+#define STACK_PROFILE_LENGTH 1024
+
+static void init_stack_profile(stack_profile_t *profile, uint64_t max_blocks) {
+    profile->length = STACK_PROFILE_LENGTH;
+    profile->fenwick = calloc(profile->length + 1, sizeof(uint32_t));
+    profile->owners = malloc((profile->length + 1) * sizeof(uint32_t));
+    profile->time = 0;
+    init_block_map(&profile->last_access);
+    profile->histogram = calloc(max_blocks, sizeof(uint64_t));
+    profile->max_blocks = max_blocks;
+}
+
+static void free_stack_profile(stack_profile_t *profile) {
+    free(profile->fenwick);
+    free(profile->owners);
+    free(profile->last_access.blocks);
+    free(profile->last_access.times);
+    free(profile->histogram);
+}
+
+static inline void fenwick_add(stack_profile_t *profile, uint64_t time, int32_t value) {
+    for (; time <= profile->length; time += time & -time) {
+        profile->fenwick[time] += value;
+    }
+}
+
+static inline uint64_t fenwick_sum(const stack_profile_t *profile, uint64_t time) {
+    uint64_t sum = 0;
+    for (; time > 0; time -= time & -time) {
+        sum += profile->fenwick[time];
+    }
+    return sum;
+}
+
+/**
+ * Renumbers the latest access of every block 1, 2, ... in access order, which keeps the stack distances
+ *
+ * The tree is doubled if the blocks take more than half of it, so at least as many accesses as there are
+ * blocks fit before the next compaction.
+ * @param profile profile whose tree is full
+ */
+static void compact_stack_profile(stack_profile_t *profile) {
+    block_map_t *map = &profile->last_access;
+    uint64_t live = 0;
+    for (uint64_t time = 1; time <= profile->time; time++) {
+        uint64_t pos = block_map_slot(map, profile->owners[time]);
+        if (map->times[pos] == time) {
+            map->times[pos] = (uint32_t) ++live;
+            profile->owners[live] = profile->owners[time];
+        }
+    }
+    if (2 * live > profile->length) {
+        profile->length *= 2;
+        free(profile->fenwick);
+        profile->fenwick = malloc((profile->length + 1) * sizeof(uint32_t));
+        profile->owners = realloc(profile->owners, (profile->length + 1) * sizeof(uint32_t));
+    }
+    /* node t covers the times (t - lowbit(t), t], the tree holds a 1 at the times 1 to live */
+    for (uint64_t time = 1; time <= profile->length; time++) {
+        uint64_t low = time - (time & -time);
+        profile->fenwick[time] = (uint32_t) ((time < live ? time : live) - (low < live ? low : live));
+    }
+    profile->time = live;
+}
+
+/**
+ * Records an access in a stack distance profile
+ * @param profile profile of the cache the access goes to
+ * @param block block address of the access
+ */
+static inline void stack_profile_access(stack_profile_t *profile, uint32_t block) {
+    if (profile->time == profile->length) {
+        compact_stack_profile(profile);
+    }
+    uint64_t time = ++profile->time;
+    block_map_t *map = &profile->last_access;
+    uint64_t pos = block_map_slot(map, block);
+    if (map->blocks[pos] == block) {
+        uint32_t last = map->times[pos];
+        uint64_t distance = fenwick_sum(profile, time - 1) - fenwick_sum(profile, last);
+        if (distance < profile->max_blocks) {
+            profile->histogram[distance]++;
+        }
+        fenwick_add(profile, last, -1);
+    } else {
+        /* first access to the block (compulsory miss) */
+        if (2 * (map->count + 1) > map->mask + 1) {
+            grow_block_map(map);
+            pos = block_map_slot(map, block);
+        }
+        map->blocks[pos] = block;
+        map->count++;
+    }
+    map->times[pos] = (uint32_t) time;
+    profile->owners[time] = block;
+    fenwick_add(profile, time, 1);
+}
+
+/* Hits of a fully associative LRU cache with <blocks> blocks */
+static uint64_t stack_profile_hits(const stack_profile_t *profile, uint64_t blocks) {
+    uint64_t hits = 0;
+    for (uint64_t distance = 0; distance < blocks && distance < profile->max_blocks; distance++) {
+        hits += profile->histogram[distance];
+    }
+    return hits;
+}
+
+static void init_dm_profile(dm_profile_t *profile, unsigned int size_count) {
+    profile->size_count = size_count;
+    profile->blocks = malloc(size_count * sizeof(uint32_t *));
+    profile->hits = calloc(size_count, sizeof(uint64_t));
+    profile->accesses = 0;
+    for (unsigned int k = 0; k < size_count; k++) {
+        profile->blocks[k] = malloc((1ULL << k) * sizeof(uint32_t));
+        memset(profile->blocks[k], 0xff, (1ULL << k) * sizeof(uint32_t));
+    }
+}
+
+static void free_dm_profile(dm_profile_t *profile) {
+    for (unsigned int k = 0; k < profile->size_count; k++) {
+        free(profile->blocks[k]);
+    }
+    free(profile->blocks);
+    free(profile->hits);
+}
+
+/**
+ * Simulates an access in the direct mapped caches of all sizes
+ * @param profile profile of the cache the access goes to
+ * @param block block address of the access
+ */
+static inline void dm_profile_access(dm_profile_t *profile, uint32_t block) {
+    profile->accesses++;
+    for (unsigned int k = 0; k < profile->size_count; k++) {
+        uint32_t *set = &profile->blocks[k][block & ((1ULL << k) - 1)];
+        if (*set == block) {
+            profile->hits[k]++;
+        } else {
+            *set = block;
+        }
+    }
+}
+
+static void print_profile_row(uint64_t size, const char *mapping, const char *org, uint64_t accesses, uint64_t hits) {
+    printf("%-10" PRIu64 " %-8s %-13s %-12" PRIu64 " %-12" PRIu64 " %.4f\n",
+           size, mapping, org, accesses, hits, accesses ? (double) hits / accesses : 0.0);
+}
+
+/**
+ * Simulates all power of two cache sizes from 128 bytes to max_size in a single pass over the trace
+ * and prints the hits of direct mapped and fully associative (LRU) unified and split caches
+ * @param trace trace to simulate
+ * @param max_size largest cache size in bytes
+ */
+void profile_cache_sizes(trace_t *trace, uint64_t max_size) {
+    /* number of power of two block counts up to the unified cache with max_size bytes */
+    unsigned int size_count = 1;
+    while (((uint64_t) 2 * DEFAULT_BLOCK_SIZE << size_count) <= max_size) {
+        size_count++;
+    }
+    uint64_t max_blocks = (uint64_t) 1 << size_count;
+
+    /* unified cache and the two halves of the split cache */
+    stack_profile_t unified_lru, split_lru[2];
+    dm_profile_t unified_dm, split_dm[2];
+    init_stack_profile(&unified_lru, max_blocks);
+    init_dm_profile(&unified_dm, size_count + 1);
+    for (int type = instruction; type <= data; type++) {
+        init_stack_profile(&split_lru[type], max_blocks / 2);
+        init_dm_profile(&split_dm[type], size_count);
+    }
+
+    uint64_t count = 0;
+    mem_access_t access;
+    while (read_transaction(trace, &access)) {
+        uint32_t block = access.address >> 6;
+        access_t type = access.accesstype;
+        count++;
+        stack_profile_access(&unified_lru, block);
+        stack_profile_access(&split_lru[type], block);
+        dm_profile_access(&unified_dm, block);
+        dm_profile_access(&split_dm[type], block);
+    }
+    check_trace(trace);
+
+    printf("%-10s %-8s %-13s %-12s %-12s %s\n", "Size", "Mapping", "Organization", "Accesses", "Hits", "Hit Rate");
+    for (unsigned int k = 0; k < size_count; k++) {
+        /* the unified cache has 2^(k+1) blocks, each half of the split cache 2^k */
+        uint64_t size = (uint64_t) DEFAULT_BLOCK_SIZE << (k + 1);
+        uint64_t blocks = (uint64_t) 1 << k;
+        print_profile_row(size, "dm", "uc", count, unified_dm.hits[k + 1]);
+        print_profile_row(size, "dm", "sc", count, split_dm[instruction].hits[k] + split_dm[data].hits[k]);
+        print_profile_row(size, "fa (LRU)", "uc", count, stack_profile_hits(&unified_lru, 2 * blocks));
+        print_profile_row(size, "fa (LRU)", "sc", count,
+                          stack_profile_hits(&split_lru[instruction], blocks) +
+                          stack_profile_hits(&split_lru[data], blocks));
+    }
+
+    free_stack_profile(&unified_lru);
+    free_dm_profile(&unified_dm);
+    for (int type = instruction; type <= data; type++) {
+        free_stack_profile(&split_lru[type]);
+        free_dm_profile(&split_dm[type]);
+    }
+}
+
+/* Multi-core simulation
+ *
+ * Either every core has a trace of its own, which are interleaved one access at a time, or a single trace
+ * names the core of every access. The accesses are read one epoch at a time.
+ */
+
+/**
+ * Prints the statistics of every core of a multi-core simulation and their totals
+ * @param mc the simulation
+ * @param cores number of cores
+ */
+void print_core_statistics(const multicore_t *mc, unsigned int cores) {
+    cache_stat_t total = {0};
+    uint64_t sharing_misses = 0;
+    printf("\n%-5s %12s %12s %9s %15s %14s %9s %11s\n", "Core", "Accesses", "Hits", "Hit Rate", "Sharing Misses",
+           "Invalidations", "Upgrades", "Writebacks");
+    for (unsigned int core = 0; core < cores; core++) {
+        core_stat_t stats = get_core_statistics(mc, core);
+        uint64_t accesses = stats.caches[instruction].accesses + stats.caches[data].accesses;
+        uint64_t hits = stats.caches[instruction].hits + stats.caches[data].hits;
+        printf("%-5u %12" PRIu64 " %12" PRIu64 " %9.4f %15" PRIu64 " %14" PRIu64 " %9" PRIu64 " %11" PRIu64 "\n", core,
+               accesses, hits, accesses ? (double) hits / accesses : 0.0, stats.sharing_misses, stats.invalidations,
+               stats.upgrades, stats.writebacks);
+        total.accesses += accesses;
+        total.hits += hits;
+        sharing_misses += stats.sharing_misses;
+    }
+
+    printf("\nCache Statistics\n");
+    printf("-----------------\n\n");
+    printf("Accesses: %" PRIu64 "\n", total.accesses);
+    printf("Hits:     %" PRIu64 "\n", total.hits);
+    printf("Hit Rate: %.4f\n", total.accesses ? (double) total.hits / total.accesses : 0.0);
+    printf("Sharing Misses: %" PRIu64 "\n", sharing_misses);
+}
+
+/**
+ * Simulates the traces of several cores with coherent private caches
+ * @param paths trace per core, or a single trace holding the core of every access
+ * @param trace_count number of traces
+ * @param config configuration of the private caches of every core
+ * @param cores number of cores, the number of traces unless a single trace is given
+ * @param threads number of worker threads
+ * @param epoch accesses per epoch
+ * @return 0 on success, 1 if a trace could not be opened
+ */
+int simulate_cores(char **paths, unsigned int trace_count, const cache_config_t *config, unsigned int cores,
+                   unsigned int threads, uint64_t epoch) {
+    trace_t *traces[MAX_CORES];
+    for (unsigned int t = 0; t < trace_count; t++) {
+        traces[t] = open_trace(paths[t]);
+        if (!traces[t]) {
+            printf("Unable to open %s\n", paths[t]);
+            return 1;
+        }
+    }
+
+    multicore_t *mc = init_multicore(config, cores, threads, epoch);
+    printf("\nMulti-core Organization\n");
+    printf("-----------------------\n");
+    printf("Cores:          %u, private %s %s caches of %" PRIu32 " bytes\n", cores, mapping_names[config->mapping],
+           org_names[config->org], config->cache_size);
+    printf("Coherence:      MESI directory, epochs of %" PRIu64 " accesses\n", epoch);
+    printf("-----------------------\n");
+
+    core_access_t *batch = malloc(epoch * sizeof(core_access_t));
+    unsigned int active = trace_count;
+    unsigned int next = 0;
+    uint64_t count;
+    do {
+        count = 0;
+        if (trace_count == 1) {
+            while (count < epoch && read_core_transaction(traces[0], &batch[count])) {
+                if (batch[count].core >= cores) {
+                    printf("Access of core %" PRIu32 ", but there are only %u cores (see --cores)\n", batch[count].core,
+                           cores);
+                    exit(0);
+                }
+                count++;
+            }
+            if (count < epoch) {
+                check_trace(traces[0]);
+            }
+        } else {
+            /* the traces take turns, a finished trace drops out */
+            while (count < epoch && active > 0) {
+                if (traces[next] && read_core_transaction(traces[next], &batch[count])) {
+                    batch[count++].core = next;
+                } else if (traces[next]) {
+                    check_trace(traces[next]);
+                    close_trace(traces[next]);
+                    traces[next] = NULL;
+                    active--;
+                }
+                next = next + 1 == trace_count ? 0 : next + 1;
+            }
+        }
+        simulate_multicore(mc, batch, count);
+    } while (count == epoch);
+
+    print_core_statistics(mc, cores);
+    free(batch);
+    free_multicore(mc);
+    for (unsigned int t = 0; t < trace_count; t++) {
+        if (traces[t]) {
+            close_trace(traces[t]);
+        }
+    }
+    return 0;
 }
 
 int main(int argc, char **argv) {
-    // Reset statistics:
-    memset(&cache_statistics, 0, sizeof(cache_stat_t));
+    /* Converter subcommand: ./cache_sim convert [text trace] [binary trace] */
+    if (argc == 4 && strcmp(argv[1], "convert") == 0) {
+        return convert_trace(argv[2], argv[3]);
+    }
+
+    /* Profiling subcommand: ./cache_sim profile [max cache size] [--file PATH] */
+    if (argc >= 2 && strcmp(argv[1], "profile") == 0) {
+        uint64_t max_size = 4096;
+        const char *trace_path = "mem_trace.txt";
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+                trace_path = argv[++i];
+            } else {
+                max_size = strtoull(argv[i], NULL, 0);
+            }
+        }
+        /* a cache larger than the 32 bit address space can not hold more blocks */
+        if (max_size > (uint64_t) UINT32_MAX + 1) {
+            printf("Invalid maximum cache size, at most 4294967296 bytes\n");
+            exit(0);
+        }
+        trace_t *trace = open_trace(trace_path);
+        if (!trace) {
+            printf("Unable to open the trace file\n");
+            exit(1);
+        }
+        profile_cache_sizes(trace, max_size);
+        close_trace(trace);
+        return 0;
+    }
+
+    /* Sweep subcommand: ./cache_sim sweep [cache sizes] [cache mappings] [cache organizations] [options],
+     * the lists are comma separated, e.g. ./cache_sim sweep 128,256,512 dm,fa uc,sc --policy lru */
+    if (argc >= 5 && strcmp(argv[1], "sweep") == 0) {
+        cache_config_t base = DEFAULT_CONFIG;
+        const char *trace_path = "mem_trace.txt";
+        for (int i = 5; i < argc; i++) {
+            if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+                trace_path = argv[++i];
+            } else if (parse_cache_option(argc, argv, &i, &base)) {
+                exit(0);
+            }
+        }
+        trace_t *trace = open_trace(trace_path);
+        if (!trace) {
+            printf("Unable to open the trace file\n");
+            exit(1);
+        }
+        int failed = sweep_configurations(trace, argv[2], argv[3], argv[4], &base);
+        close_trace(trace);
+        return failed;
+    }
+
+    /* Multi-core subcommand: ./cache_sim multicore [cache size] [cache mapping] [cache organization] [trace files]
+     * [options], one trace per core or a single trace that names the core of every access */
+    if (argc >= 6 && strcmp(argv[1], "multicore") == 0) {
+        cache_config_t config = DEFAULT_CONFIG;
+        unsigned int cores = 0;
+        unsigned int threads = 0;
+        uint64_t epoch = 0;
+        config.cache_size = (uint32_t) atoi(argv[2]);
+        if (parse_mapping(argv[3], &config.mapping) || parse_org(argv[4], &config.org)) {
+            printf("Unknown cache mapping or organization\n");
+            exit(0);
+        }
+        unsigned int trace_count = 0;
+        while (5 + trace_count < (unsigned int) argc && strncmp(argv[5 + trace_count], "--", 2) != 0) {
+            trace_count++;
+        }
+        for (int i = 5 + (int) trace_count; i < argc; i++) {
+            if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+                cores = (unsigned int) atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                threads = (unsigned int) atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--epoch") == 0 && i + 1 < argc) {
+                epoch = strtoull(argv[++i], NULL, 10);
+            } else if (parse_cache_option(argc, argv, &i, &config)) {
+                exit(0);
+            }
+        }
+        if (trace_count == 0 || (trace_count > 1 && cores && cores != trace_count)) {
+            printf("Expected one trace per core or a single trace with the core of every access\n");
+            exit(0);
+        }
+        if (cores == 0) {
+            cores = trace_count;
+        }
+        const char *problem = validate_multicore(&config, cores);
+        if (problem) {
+            printf("Invalid multi-core configuration: %s\n", problem);
+            exit(0);
+        }
+        /* one worker per core, but not more workers than host cores */
+        if (threads == 0) {
+            long host_cores = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = host_cores > 0 && (unsigned long) host_cores < cores ? (unsigned int) host_cores : cores;
+        }
+        if (epoch == 0) {
+            epoch = (uint64_t) 1024 * cores;
+        }
+        return simulate_cores(&argv[5], trace_count, &config, cores, threads, epoch);
+    }
 
     /* Read command-line parameters and initialize:
-     * cache_size, cache_mapping and cache_org variables
+     * cache_size, mapping and org of the cache configuration
      */
     /* IMPORTANT: *IF* YOU ADD COMMAND LINE PARAMETERS (you really don't need to),
      * MAKE SURE TO ADD THEM IN THE END AND CHOOSE SENSIBLE DEFAULTS SUCH THAT WE
      * CAN RUN THE RESULTING BINARY WITHOUT HAVING TO SUPPLY MORE PARAMETERS THAN
      * SPECIFIED IN THE UNMODIFIED FILE (cache_size, cache_mapping and cache_org)
      */
-    if (argc != 4) { /* argc should be 2 for correct execution */
+    cache_config_t config = DEFAULT_CONFIG;
+    const char *trace_path = "mem_trace.txt";
+    int report_timing = 0;
+    int filter_runs = 1;
+    uint64_t interval = 0;
+    uint64_t warmup = 0;
+    const char *interval_path = "intervals.csv";
+    const char *checkpoint_path = NULL;
+    uint64_t checkpoint_every = DEFAULT_CHECKPOINT_EVERY;
+    const char *resume_path = NULL;
+    int warm_start = 0;
+    if (argc < 4) { /* argc should be 4 for correct execution */
         printf(
-                "Usage: ./cache_sim [cache size: 128-4096] [cache mapping: dm|fa] "
-                "[cache organization: uc|sc]\n");
+                "Usage: ./cache_sim [cache size: 128-4096] [cache mapping: dm|fa|sa] "
+                "[cache organization: uc|sc] [options]\n"
+                "       ./cache_sim convert [text trace] [binary trace]\n"
+                "       ./cache_sim profile [max cache size] [--file PATH]\n"
+                "       ./cache_sim sweep [cache sizes] [cache mappings] [cache organizations] [options]\n"
+                "       ./cache_sim multicore [cache size] [cache mapping] [cache organization] [trace files] [options]\n"
+                "Options:\n"
+                "  --ways N          ways of a set associative cache (default 4)\n"
+                "  --policy P        replacement policy: fifo|lru|plru|random (default fifo)\n"
+                "  --l2 SIZE         add a unified L2 cache of SIZE bytes\n"
+                "  --l3 SIZE         add a unified L3 cache of SIZE bytes below the L2 cache\n"
+                "  --l2-ways N       ways of the L2 cache (default 8)\n"
+                "  --l3-ways N       ways of the L3 cache (default 16)\n"
+                "  --inclusion P     inclusion policy of the hierarchy: inclusive|exclusive (default inclusive)\n"
+                "  --latency LIST    L1,L2,L3,memory latencies in cycles for the AMAT (default 1,10,40,200)\n"
+                "  --file PATH       trace file, - for stdin, may be gzip or zstd compressed (default mem_trace.txt)\n"
+                "  --no-filter       simulate repeated accesses to a block instead of counting them as hits\n"
+                "  --interval N      write the statistics of every cache after every N accesses\n"
+                "  --interval-file PATH  CSV file of the interval statistics (default intervals.csv)\n"
+                "  --warmup K        exclude the first K accesses from the statistics\n"
+                "  --3c              classify the misses into compulsory, capacity and conflict misses\n"
+                "  --sample K        simulate every K-th set only and extrapolate the statistics\n"
+                "  --sample-hash K   simulate one in K sets picked by a hash of the set index\n"
+                "  --timing          report parse and simulation throughput\n"
+                "  --checkpoint PATH save the state of the run to PATH periodically and at the end of the trace\n"
+                "  --checkpoint-every N  accesses between two checkpoints (default 100000000)\n"
+                "  --resume PATH     continue the run of a checkpoint, with the same trace and options\n"
+                "  --warm-start PATH start with the caches of a checkpoint, e.g. of another trace, but no statistics\n"
+                "Multi-core options (one trace per core, or one trace with \"I|D address [R|W] [core]\" records):\n"
+                "  --cores N         number of cores of a single trace (default 1, one core per trace otherwise)\n"
+                "  --epoch N         accesses of all cores per epoch, coherence takes effect between epochs\n"
+                "                    (default 1024 per core)\n"
+                "  --threads N       worker threads (default one per core, at most one per host core)\n");
         exit(0);
     } else {
         /* argv[0] is program name, parameters start with argv[1] */
 
         /* Set cache size */
-        cache_size = atoi(argv[1]);
+        config.cache_size = atoi(argv[1]);
 
         /* Set Cache Mapping */
-        if (strcmp(argv[2], "dm") == 0) {
-            cache_mapping = dm;
-        } else if (strcmp(argv[2], "fa") == 0) {
-            cache_mapping = fa;
-        } else {
+        if (parse_mapping(argv[2], &config.mapping)) {
             printf("Unknown cache mapping\n");
             exit(0);
         }
 
         /* Set Cache Organization */
-        if (strcmp(argv[3], "uc") == 0) {
-            cache_org = uc;
-        } else if (strcmp(argv[3], "sc") == 0) {
-            cache_org = sc;
-        } else {
+        if (parse_org(argv[3], &config.org)) {
             printf("Unknown cache organization\n");
             exit(0);
         }
+
+        /* Optional parameters */
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--timing") == 0) {
+                report_timing = 1;
+            } else if (strcmp(argv[i], "--no-filter") == 0) {
+                filter_runs = 0;
+            } else if (strcmp(argv[i], "--3c") == 0) {
+                config.classify = 1;
+            } else if ((strcmp(argv[i], "--sample") == 0 || strcmp(argv[i], "--sample-hash") == 0) && i + 1 < argc) {
+                config.sample_hash = strcmp(argv[i], "--sample-hash") == 0;
+                config.sample_sets = (uint32_t) atoi(argv[++i]);
+                if (config.sample_sets == 0) {
+                    printf("Invalid sampling factor\n");
+                    exit(0);
+                }
+            } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+                trace_path = argv[++i];
+            } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+                interval = strtoull(argv[++i], NULL, 10);
+                if (interval == 0) {
+                    printf("Invalid interval\n");
+                    exit(0);
+                }
+            } else if (strcmp(argv[i], "--interval-file") == 0 && i + 1 < argc) {
+                interval_path = argv[++i];
+            } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+                warmup = strtoull(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+                checkpoint_path = argv[++i];
+            } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+                checkpoint_every = strtoull(argv[++i], NULL, 10);
+                if (checkpoint_every == 0) {
+                    printf("Invalid checkpoint interval\n");
+                    exit(0);
+                }
+            } else if ((strcmp(argv[i], "--resume") == 0 || strcmp(argv[i], "--warm-start") == 0) && i + 1 < argc) {
+                if (resume_path) {
+                    printf("Only one of --resume and --warm-start can be given\n");
+                    exit(0);
+                }
+                warm_start = strcmp(argv[i], "--warm-start") == 0;
+                resume_path = argv[++i];
+            } else if (parse_cache_option(argc, argv, &i, &config)) {
+                exit(0);
+            }
+        }
+
+        const char *problem = validate_config(&config);
+        if (problem) {
+            printf("Invalid cache configuration: %s\n", problem);
+            exit(0);
+        }
+        /* the shadow caches, intervals and the warm-up window count every access */
+        if (config.sample_sets > 1 && (config.classify || interval || warmup)) {
+            printf("Sampling cannot be combined with --3c, --interval or --warmup\n");
+            exit(0);
+        }
+        /* the interval statistics file is rewritten by every run */
+        if (resume_path && !warm_start && interval) {
+            printf("--resume cannot be combined with --interval\n");
+            exit(0);
+        }
     }
 
-    /* Open the file mem_trace.txt to read memory accesses */
-    FILE *ptr_file;
-    ptr_file = fopen("mem_trace.txt", "r");
-    if (!ptr_file) {
+    /* Open the trace file (mem_trace.txt by default) to read memory accesses */
+    trace_t *trace = open_trace(trace_path);
+    if (!trace) {
         printf("Unable to open the trace file\n");
         exit(1);
     }
+    /* a streamed trace can only be read once */
+    if (report_timing && trace_rewindable(trace)) {
+        report_parse_throughput(trace);
+    }
 
     /* initialise cache and allocate memory */
-    cache_t *cache;
-    cache_t *instruction_cache;
-    cache_t *data_cache;
-    if (cache_org == uc) {
-        cache = init_cache(cache_size / block_size);
-    }
-    else {
-        instruction_cache = init_cache((cache_size / 2) / block_size);
-        data_cache = init_cache((cache_size / 2) / block_size);
+    simulation_t *sim = init_simulation(&config);
+    if (config.sample_sets > 1 && !simulation_sample(sim)) {
+        printf("The sampling factor selects no set\n");
+        exit(0);
     }
+    print_cache_organization(sim);
 
-    /* Loop until whole trace file has been read */
-    mem_access_t access;
-    uint64_t tag;
-    while (1) {
-        access = read_transaction(ptr_file);
-        // If no transactions left, break out of loop
-        if (access.address == 0) break;
-        // printf("%d %x\n", access.accesstype, access.address);
-        /* Do a cache access */
-
-        // ADD YOUR CODE HERE
-
-        /* if split cache, cache is used as a pointer to the individual caches based on the instruction */
-        if (cache_org == sc) {
-            if (access.accesstype == instruction) {
-                cache = instruction_cache;
-            } else {
-                cache = data_cache;
-            }
+    /* a resumed run continues the trace after the last access of the checkpoint, a warm start only
+     * keeps the contents of the caches */
+    checkpoint_header_t resumed = {.accesses = 0};
+    if (resume_path) {
+        const char *problem = load_checkpoint(resume_path, sim, &resumed);
+        if (problem) {
+            printf("Unable to load %s: %s\n", resume_path, problem);
+            exit(1);
         }
+        if (warm_start) {
+            clear_statistics(sim);
+            memset(&resumed, 0, sizeof(resumed));
+        } else if (seek_trace(trace, &resumed.position)) {
+            check_trace(trace);
+            printf("The trace ends before the position of the checkpoint\n");
+            exit(1);
+        } else {
+            fprintf(stderr, "Resuming after %" PRIu64 " accesses\n", resumed.accesses);
+        }
+    }
+    checkpoint_writer_t *checkpoints = NULL;
+    uint64_t next_checkpoint = (resumed.accesses / checkpoint_every + 1) * checkpoint_every;
+    if (checkpoint_path) {
+        checkpoints = open_checkpoints(checkpoint_path, sim);
+    }
 
-        /* cache access */
-        if (cache_mapping == dm) {
-            /* get the set (block) position in the cache */
-            uint64_t set_pos = (access.address >> 6) & (cache->block_count - 1);
-
-            /* get the tag */
-            uint64_t index_bit_count = (uint64_t) log2l(cache->block_count);
-            tag = access.address >> (6 + index_bit_count);
+    interval_log_t *interval_log = NULL;
+    if (interval) {
+        interval_log = open_interval_log(interval_path, sim);
+        if (!interval_log) {
+            printf("Unable to create %s\n", interval_path);
+            exit(1);
+        }
+    }
 
-            /* check if the cache at set_pos has the same tag and is valid => cache hit */
-            if (cache->tags[set_pos] == tag && cache->valid_tags[set_pos]) {
-                cache_statistics.hits++;
-            } else {
-                /* tags are not the same or set is not valid => cache miss */
-                cache->tags[set_pos] = tag;
-                cache->valid_tags[set_pos] = 1;
-            }
-            cache_statistics.accesses++;
+    /* Loop until whole trace file has been read, the reader thread parses and run filters
+     * the accesses into batches while the previous batches are simulated. Batches end at the
+     * interval and warm-up boundaries, so the statistics are inspected between batches only. Where
+     * the lower levels run does not depend on the batches, so the boundaries do not change the results. */
+    run_filter_t filter;
+    init_run_filter(&filter, &config);
+    pipeline_t *pipeline = start_pipeline(trace, filter_runs && run_filter_exact(&config) ? &filter : NULL,
+                                          interval, warmup, simulation_sample(sim), resumed.accesses);
+    stat_snapshot_t warmup_snapshot = resumed.warmup;
+    int warmed_up = warmup == 0 || resumed.warmed_up;
+    uint64_t logged = 0;
+    int last;
+    struct timespec begin, start, stop, end;
+    double simulation_seconds = 0;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    do {
+        const access_batch_t *batch = next_batch(pipeline);
+        last = batch->last;
+        uint64_t read = batch->read;
+        trace_position_t position = batch->position;
+        /* Do the cache accesses */
+        if (report_timing) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            simulate_accesses(sim, batch->accesses, batch->count);
+            clock_gettime(CLOCK_MONOTONIC, &stop);
+            simulation_seconds += (double) (stop.tv_sec - start.tv_sec) + (double) (stop.tv_nsec - start.tv_nsec) * 1e-9;
         } else {
-            /* get the tag (corresponds to the address shifted
-             * right by 6 bits since we don`t have any index bits */
-            tag = access.address >> 6;
-
-            uint8_t cache_full = 1;
-            for (uint64_t i = 0; i < cache->block_count; i++) {
-                /* check if tag stored in cache is the same as the current tag and if
-                 * the block is valid => cache hit; otherwise continue searching*/
-                if (cache->tags[i] == tag && cache->valid_tags[i]) {
-                    cache_statistics.hits++;
-                    cache_full = 0;
-                    break;
-                }
-                /* if a cache block is invalid, all the following cache blocks are invalid
-                 * Hence, there is no block in the cache with the same tag => cache miss
-                 * Still, the cache is not full, thus, we don´t have to evict any data */
-                if (!cache->valid_tags) {
-                    cache->tags[i] = tag;
-                    cache->valid_tags[i] = 1;
-                    cache_full = 0;
-                    break;
-                }
-            }
-            /* cache is full. Evict entry at which the fifo pointer is pointing. Increment the
-             * pointer afterwards. => cache miss */
-            if (cache_full) {
-                cache->tags[cache->fifo_pointer] = tag;
-                cache->valid_tags[cache->fifo_pointer] = 1;
-                cache->fifo_pointer = (cache->fifo_pointer + 1) % cache->block_count;
-            }
-            cache_statistics.accesses++;
+            simulate_accesses(sim, batch->accesses, batch->count);
         }
-    }
+        release_batch(pipeline);
 
-    /* free caches */
-    if (cache_org == uc) {
-        free(cache);
-    } else {
-        free(instruction_cache);
-        free(data_cache);
+        uint64_t simulated = simulation_statistics(sim).accesses;
+        if (!warmed_up && simulated == warmup) {
+            take_snapshot(sim, &warmup_snapshot);
+            warmed_up = 1;
+        }
+        /* the last interval of the trace may be shorter */
+        if (interval_log && simulated != logged && (simulated % interval == 0 || last)) {
+            log_interval(interval_log, sim);
+            logged = simulated;
+        }
+        if (checkpoints && (read >= next_checkpoint || last)) {
+            checkpoint_header_t header = {.accesses = read, .position = position, .warmed_up = (uint64_t) warmed_up,
+                                          .warmup = warmup_snapshot};
+            write_checkpoint(checkpoints, sim, &header);
+            next_checkpoint = (read / checkpoint_every + 1) * checkpoint_every;
+        }
+    } while (!last);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stop_pipeline(pipeline);
+    check_trace(trace);
+    if (report_timing) {
+        uint64_t simulated = simulation_statistics(sim).accesses;
+        double total_seconds = (double) (end.tv_sec - begin.tv_sec) + (double) (end.tv_nsec - begin.tv_nsec) * 1e-9;
+        fprintf(stderr, "Simulated %" PRIu64 " accesses in %.3f ms: %.1f M accesses/s\n", simulated,
+                simulation_seconds * 1e3, (double) simulated / 1e6 / simulation_seconds);
+        fprintf(stderr, "Read and simulated the trace in %.3f ms\n", total_seconds * 1e3);
+    }
+    if (checkpoints && close_checkpoints(checkpoints)) {
+        printf("Unable to write %s\n", checkpoint_path);
+        exit(1);
+    }
+    if (interval_log && close_interval_log(interval_log)) {
+        printf("Unable to write %s\n", interval_path);
+        exit(1);
+    }
+    if (!warmed_up) {
+        fprintf(stderr, "The trace has only %" PRIu64 " accesses, all of them are in the warm-up window\n",
+                simulation_statistics(sim).accesses);
+        take_snapshot(sim, &warmup_snapshot);
+    }
+    if (warmup) {
+        exclude_warmup(sim, &warmup_snapshot);
     }
+    if (simulation_sample(sim)) {
+        finish_sampling(sim);
+    }
+    cache_stat_t cache_statistics = simulation_statistics(sim);
 
     /* Print the statistics */
     // DO NOT CHANGE THE FOLLOWING LINES!
@@ -257,7 +1636,11 @@ int main(int argc, char **argv) {
            (double) cache_statistics.hits / cache_statistics.accesses);
     // DO NOT CHANGE UNTIL HERE
     // You can extend the memory statistic printing if you like!
+    print_extended_statistics(sim);
+
+    /* free caches */
+    free_simulation(sim);
 
     /* Close the trace file */
-    fclose(ptr_file);
+    close_trace(trace);
 }
@@ -0,0 +1,2213 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cachesim.h"
+
+/* How a cache finds the block holding a tag */
+typedef enum {
+    direct_lookup,  // a single block per set (direct mapped)
+    linear_lookup,  // compare against every way of a set with few ways
+    scan_lookup,    // compare against every way of the set (vectorized)
+    index_lookup    // hash index from block address to block, for caches with many ways
+} lookup_t;
+
+/* How a cache keeps its replacement state, derived from the policy and the number of ways */
+typedef enum {
+    fifo_replacement,       // next way to replace per set
+    lru_stack_replacement,  // recency stack of 4 bit way numbers in one word per set (up to 16 ways)
+    lru_list_replacement,   // doubly linked recency list per set (more than 16 ways)
+    plru_replacement,       // tree of ways - 1 direction bits per set
+    random_replacement      // random number generator per cache
+} replacement_t;
+
+/* Lookup used for sets with fewer ways than this */
+#define LINEAR_LOOKUP_LIMIT 8
+/* Associativity up to which scanning all tags is faster than the hash index */
+#define SCAN_LOOKUP_LIMIT 64
+/* Associativity up to which LRU fits into a recency stack word */
+#define LRU_STACK_LIMIT 16
+
+/* Addresses have 32 bits (see mem_access_t), so a tag never has more than 32 - block offset bits
+ * and fits into 32 bits with room for the invalid tag. Invalid blocks hold INVALID_TAG, real tags
+ * never take this value, so no separate valid bits are needed.
+ */
+#define ADDRESS_BITS 32
+typedef uint32_t tag_t;
+#define INVALID_TAG UINT32_MAX
+
+/* Tag arrays and indices are aligned to host cache lines */
+#define CACHE_LINE_SIZE 64
+
+/* Entry of the hash index, position is the index into tags plus one, 0 marks an empty entry */
+typedef struct {
+    uint32_t block;
+    uint32_t position;
+} index_entry_t;
+
+typedef struct {
+    tag_t *tags;            // tags of set s start at tags[s * stride]
+    uint64_t block_count;
+    uint64_t set_count;
+    uint32_t ways;
+    uint32_t stride;        // ways padded to the width of the vectorized lookup
+    /* address decoding, computed once by init_cache */
+    unsigned int offset_bits;
+    unsigned int set_bits;
+    uint64_t set_mask;
+    lookup_t lookup;
+    cache_policy_t policy;
+    replacement_t replacement;
+    /* replacement state, sets are filled in way order before anything is evicted */
+    uint32_t *filled;       // valid ways per set, ways [0, filled) unless blocks have been invalidated
+    uint32_t *fifo_pointer; // next way to evict per set
+    uint64_t *lru_stack;    // most recently used way in the lowest nibble
+    uint32_t *lru_prev;     // recency list links per block, towards the most recently used way
+    uint32_t *lru_next;
+    uint32_t *lru_head;     // most recently used way per set
+    uint32_t *lru_tail;     // least recently used way per set
+    uint64_t *plru_bits;    // tree node n of set s is bit n of the plru_words words at plru_bits[s * plru_words]
+    uint32_t plru_words;
+    uint64_t *plru_path_mask;   // nodes on the path to each way and their values after touching it (single word trees)
+    uint64_t *plru_path_bits;
+    uint64_t random_state;
+    /* open addressing hash table from block address to position in tags (index lookup only).
+     * Only valid blocks are indexed.
+     */
+    index_entry_t *index;
+    uint64_t index_mask;
+    unsigned int index_shift;
+    cache_stat_t statistics;
+} cache_t;
+
+/* A miss of a level of a hierarchy, forwarded to the level below. The addresses are
+ * block aligned, hence never equal to NO_ADDRESS.
+ */
+#define NO_ADDRESS UINT32_MAX
+typedef struct {
+    uint32_t address;   // missed block or NO_ADDRESS
+    uint32_t victim;    // block evicted by the miss or NO_ADDRESS
+} miss_t;
+
+/* Sets simulated by a sampled simulation
+ *
+ * Sets are selected by their key, the lowest set index bits that every level of the hierarchy shares,
+ * so every level simulates the same fraction of its sets and a sampled set of a level only receives
+ * misses from sampled sets of the level above.
+ */
+struct set_sample {
+    uint64_t *keys;             // bit per key, set if the sets with this key are simulated
+    uint64_t key_count;         // sets of the level with the fewest sets
+    uint64_t key_mask;
+    unsigned int offset_bits;
+    uint64_t sampled;           // number of simulated keys
+    uint64_t *accesses;         // accesses per key, for the confidence interval
+    uint64_t *misses;           // first level misses per key
+    double hit_rate;            // hit rate of the sampled sets, set by finish_sampling
+    double margin;              // half width of the 95% confidence interval of hit_rate, NAN for a single key
+};
+
+/**
+ * Checks whether an access maps to a sampled set
+ * @param sample the sampled sets
+ * @param address memory address of the access
+ * @return 1 if the access is simulated, 0 if it is skipped
+ */
+int sample_access(const set_sample_t *sample, uint32_t address) {
+    uint64_t key = (address >> sample->offset_bits) & sample->key_mask;
+    return (int) ((sample->keys[key >> 6] >> (key & 63)) & 1);
+}
+
+/* Simulates a batch of accesses, there is one kernel per lookup, replacement and organization */
+typedef void (*access_kernel_t)(simulation_t *sim, const mem_access_t *accesses, uint64_t count);
+
+/* Simulates a batch of misses of the level above on a lower level, returns the number of forwarded records */
+typedef uint64_t (*level_kernel_t)(cache_t *cache, const miss_t *misses, uint64_t count, miss_t *forwarded,
+                                   inclusion_t inclusion);
+
+/* State of a single simulation, simulations do not share any state */
+struct simulation {
+    cache_config_t config;
+    // USE THIS FOR YOUR CACHE STATISTICS
+    cache_stat_t statistics;
+    cache_t *caches[2]; // cache per access type, both point to the same cache for a unified cache
+    access_kernel_t kernel;
+    /* lower levels of a hierarchy, level l + 1 only sees the misses of level l */
+    unsigned int level_count;               // 1 without lower levels
+    cache_t *levels[MAX_LEVELS - 1];
+    level_kernel_t level_kernels[MAX_LEVELS - 1];
+    miss_t *misses[MAX_LEVELS];             // misses of every level in the current batch, NULL without lower levels
+    uint64_t miss_count;                    // misses of the first level in the current batch
+    /* miss classification, NULL unless classify is set */
+    cache_t *shadows[2];                    // fully associative LRU cache per first level cache
+    uint64_t *seen[2];                      // bit per block address that has been accessed, per first level cache
+    set_sample_t *sample;                   // sampled sets, NULL if every set is simulated
+    uint64_t warmup_accesses;               // accesses excluded from the statistics
+};
+
+/* Allocates zero or more bytes aligned to a host cache line */
+static void *alloc_aligned(size_t size) {
+    size = (size + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+    return aligned_alloc(CACHE_LINE_SIZE, size ? size : CACHE_LINE_SIZE);
+}
+
+/* Vectorized tag lookup
+ *
+ * The lookup compares a probe tag against the tags of a set, padded to a multiple of TAG_SCAN_WIDTH,
+ * and returns the way of the first match or -1. Invalid blocks hold INVALID_TAG, so the comparison
+ * also checks validity. The implementation is selected at runtime: AVX2 (8 tags per compare), SSE2
+ * (4 tags per compare) or a scalar loop on other architectures.
+ */
+#define TAG_SCAN_WIDTH 8
+
+typedef int64_t (*tag_scan_t)(const tag_t *tags, uint64_t count, tag_t tag);
+
+static int64_t scan_tags_scalar(const tag_t *tags, uint64_t count, tag_t tag) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (tags[i] == tag) {
+            return (int64_t) i;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static int64_t scan_tags_sse2(const tag_t *tags, uint64_t count, tag_t tag) {
+    const __m128i probe = _mm_set1_epi32((int32_t) tag);
+    for (uint64_t i = 0; i < count; i += 8) {
+        __m128i low = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &tags[i]), probe);
+        __m128i high = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &tags[i + 4]), probe);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(low)) | (_mm_movemask_ps(_mm_castsi128_ps(high)) << 4);
+        if (mask) {
+            return (int64_t) (i + __builtin_ctz(mask));
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int64_t scan_tags_avx2(const tag_t *tags, uint64_t count, tag_t tag) {
+    const __m256i probe = _mm256_set1_epi32((int32_t) tag);
+    for (uint64_t i = 0; i < count; i += 8) {
+        __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &tags[i]), probe);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+        if (mask) {
+            return (int64_t) (i + __builtin_ctz(mask));
+        }
+    }
+    return -1;
+}
+#endif
+
+/* Picks the fastest tag lookup the CPU supports */
+static tag_scan_t select_tag_scan(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_tags_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return scan_tags_sse2;
+    }
+#endif
+    return scan_tags_scalar;
+}
+
+static tag_scan_t scan_tags;
+static pthread_once_t scan_tags_once = PTHREAD_ONCE_INIT;
+
+static void init_tag_scan(void) {
+    scan_tags = select_tag_scan();
+}
+
+static unsigned int log2_int(uint64_t value) {
+    unsigned int bits = 0;
+    while ((1ULL << bits) < value) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * Initialises a cache based on the block count
+ *
+ * The data blocks are ignored since they were not required by the assignment
+ * @param block_count number of blocks
+ * @param block_size size of a block in bytes, a power of two
+ * @param ways number of blocks per set, 1 for a direct mapped and block_count for a fully associative cache
+ * @param policy replacement policy
+ * @return a cache with <block_count> blocks
+ */
+static cache_t *init_cache(uint64_t block_count, uint32_t block_size, uint32_t ways, cache_policy_t policy) {
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    cache->block_count = block_count;
+    cache->ways = ways;
+    cache->set_count = block_count / ways;
+    cache->policy = policy;
+
+    /* pick how blocks are looked up */
+    if (ways == 1) {
+        cache->lookup = direct_lookup;
+    } else if (ways < LINEAR_LOOKUP_LIMIT) {
+        cache->lookup = linear_lookup;
+    } else if (ways <= SCAN_LOOKUP_LIMIT) {
+        cache->lookup = scan_lookup;
+    } else {
+        cache->lookup = index_lookup;
+    }
+
+    /* the tags of a set are padded with invalid tags so the vectorized lookup needs no scalar tail */
+    cache->stride = ways;
+    if (cache->lookup == scan_lookup) {
+        cache->stride = (ways + TAG_SCAN_WIDTH - 1) & ~(uint32_t) (TAG_SCAN_WIDTH - 1);
+    }
+    uint64_t tag_count = cache->set_count * cache->stride;
+    cache->tags = alloc_aligned(tag_count * sizeof(tag_t));
+    for (uint64_t i = 0; i < tag_count; i++) {
+        cache->tags[i] = INVALID_TAG;
+    }
+
+    cache->offset_bits = log2_int(block_size);
+    cache->set_bits = log2_int(cache->set_count);
+    cache->set_mask = cache->set_count - 1;
+    assert(ADDRESS_BITS - cache->offset_bits - cache->set_bits < 8 * sizeof(tag_t));
+
+    /* replacement state */
+    cache->filled = calloc(cache->set_count, sizeof(uint32_t));
+    switch (policy) {
+        case fifo:
+            cache->replacement = fifo_replacement;
+            cache->fifo_pointer = calloc(cache->set_count, sizeof(uint32_t));
+            break;
+        case lru:
+            if (ways <= LRU_STACK_LIMIT) {
+                /* way w starts at position w of the stack */
+                cache->replacement = lru_stack_replacement;
+                cache->lru_stack = malloc(cache->set_count * sizeof(uint64_t));
+                for (uint64_t set = 0; set < cache->set_count; set++) {
+                    cache->lru_stack[set] = 0xFEDCBA9876543210ULL;
+                }
+            } else {
+                /* way 0 is the most recently used way and ways - 1 the least recently used */
+                cache->replacement = lru_list_replacement;
+                cache->lru_prev = malloc(block_count * sizeof(uint32_t));
+                cache->lru_next = malloc(block_count * sizeof(uint32_t));
+                cache->lru_head = calloc(cache->set_count, sizeof(uint32_t));
+                cache->lru_tail = malloc(cache->set_count * sizeof(uint32_t));
+                for (uint64_t set = 0; set < cache->set_count; set++) {
+                    cache->lru_tail[set] = ways - 1;
+                    for (uint32_t way = 0; way < ways; way++) {
+                        cache->lru_prev[set * ways + way] = way - 1;
+                        cache->lru_next[set * ways + way] = way + 1;
+                    }
+                }
+            }
+            break;
+        case plru:
+            cache->replacement = plru_replacement;
+            cache->plru_words = (ways + 63) / 64;
+            cache->plru_bits = calloc(cache->set_count * cache->plru_words, sizeof(uint64_t));
+            if (cache->plru_words == 1) {
+                /* a touch sets every node on the path to the way to point away from it */
+                cache->plru_path_mask = calloc(ways, sizeof(uint64_t));
+                cache->plru_path_bits = calloc(ways, sizeof(uint64_t));
+                for (uint32_t way = 0; way < ways; way++) {
+                    for (uint64_t node = way + ways; node > 1; node >>= 1) {
+                        cache->plru_path_mask[way] |= 1ULL << (node >> 1);
+                        cache->plru_path_bits[way] |= (uint64_t) (~node & 1) << (node >> 1);
+                    }
+                }
+            }
+            break;
+        case rnd:
+            cache->replacement = random_replacement;
+            cache->random_state = 0x853C49E6748FEA9BULL;
+            break;
+    }
+
+    /* keep the load factor of the index at or below 1/2 */
+    if (cache->lookup == index_lookup) {
+        unsigned int index_bits = log2_int(2 * block_count);
+        cache->index = alloc_aligned((1ULL << index_bits) * sizeof(index_entry_t));
+        memset(cache->index, 0, (1ULL << index_bits) * sizeof(index_entry_t));
+        cache->index_mask = (1ULL << index_bits) - 1;
+        cache->index_shift = 64 - index_bits;
+    }
+    return cache;
+}
+
+/**
+ * Frees a cache and its tag arrays
+ * @param cache cache to free
+ */
+static void free_cache(cache_t *cache) {
+    free(cache->tags);
+    free(cache->filled);
+    free(cache->fifo_pointer);
+    free(cache->lru_stack);
+    free(cache->lru_prev);
+    free(cache->lru_next);
+    free(cache->lru_head);
+    free(cache->lru_tail);
+    free(cache->plru_bits);
+    free(cache->plru_path_mask);
+    free(cache->plru_path_bits);
+    free(cache->index);
+    free(cache);
+}
+
+/* Position of a block address in the index (fibonacci hashing) */
+static inline uint64_t index_home(const cache_t *cache, uint32_t block) {
+    return ((uint64_t) block * 0x9E3779B97F4A7C15ULL) >> cache->index_shift;
+}
+
+/**
+ * Looks up a block address in the index
+ * @param cache cache to search
+ * @param block block address (address without the block offset)
+ * @return the position of the block in tags or -1 if the block is not cached
+ */
+static inline int64_t index_find(const cache_t *cache, uint32_t block) {
+    uint64_t pos = index_home(cache, block);
+    const index_entry_t *entry;
+    while ((entry = &cache->index[pos])->position != 0) {
+        if (entry->block == block) {
+            return (int64_t) entry->position - 1;
+        }
+        pos = (pos + 1) & cache->index_mask;
+    }
+    return -1;
+}
+
+/**
+ * Adds a block that has been filled to the index
+ * @param cache cache the block belongs to
+ * @param block block address
+ * @param position position of the block in tags
+ */
+static inline void index_insert(cache_t *cache, uint32_t block, uint64_t position) {
+    uint64_t pos = index_home(cache, block);
+    while (cache->index[pos].position != 0) {
+        pos = (pos + 1) & cache->index_mask;
+    }
+    cache->index[pos].block = block;
+    cache->index[pos].position = (uint32_t) (position + 1);
+}
+
+/**
+ * Removes a block from the index before it is evicted
+ *
+ * The following entries of the probe sequence are shifted back,
+ * so no tombstones are needed
+ * @param cache cache the block belongs to
+ * @param block block address of the evicted block
+ */
+static inline void index_remove(cache_t *cache, uint32_t block) {
+    uint64_t pos = index_home(cache, block);
+    while (cache->index[pos].block != block || cache->index[pos].position == 0) {
+        pos = (pos + 1) & cache->index_mask;
+    }
+
+    uint64_t next = pos;
+    while (1) {
+        next = (next + 1) & cache->index_mask;
+        index_entry_t entry = cache->index[next];
+        if (entry.position == 0) {
+            break;
+        }
+        /* move the entry into the hole if its home is not between the hole and its position */
+        uint64_t home = index_home(cache, entry.block);
+        if (((next - home) & cache->index_mask) >= ((next - pos) & cache->index_mask)) {
+            cache->index[pos] = entry;
+            pos = next;
+        }
+    }
+    cache->index[pos].position = 0;
+}
+
+/* Replacement policies
+ *
+ * touch_way is called on every hit and fill of a way, pick_victim picks the way to evict from a full set.
+ * Both are inlined with a constant replacement, so every kernel only contains its own policy.
+ */
+static inline uint64_t low_nibbles(unsigned int count) {
+    return count >= 16 ? ~0ULL : (1ULL << (4 * count)) - 1;
+}
+
+/* Moves a way to the bottom (most recently used end) of an LRU stack */
+static inline uint64_t lru_stack_touch(uint64_t stack, uint32_t way) {
+    /* find the nibble holding way (lowest zero nibble of stack ^ way) and move it to the bottom */
+    uint64_t x = stack ^ (way * 0x1111111111111111ULL);
+    uint64_t zero_nibbles = (x - 0x1111111111111111ULL) & ~x & 0x8888888888888888ULL;
+    unsigned int position = (unsigned int) __builtin_ctzll(zero_nibbles) / 4;
+    return (stack & ~low_nibbles(position + 1)) | ((stack & low_nibbles(position)) << 4) | way;
+}
+
+static inline __attribute__((always_inline)) void
+touch_way(cache_t *cache, uint64_t set, uint32_t way, const replacement_t replacement) {
+    switch (replacement) {
+        case fifo_replacement:
+            /* neither hits nor fills change the fifo order. A set is filled in way order, so the pointer, which
+             * pick_victim advances when it evicts, always points at the oldest way. A way filled again after
+             * an invalidation keeps its old place in the order. */
+            break;
+        case lru_stack_replacement:
+            cache->lru_stack[set] = lru_stack_touch(cache->lru_stack[set], way);
+            break;
+        case lru_list_replacement: {
+            uint32_t *prev = &cache->lru_prev[set * cache->ways];
+            uint32_t *next = &cache->lru_next[set * cache->ways];
+            uint32_t head = cache->lru_head[set];
+            if (head == way) {
+                break;
+            }
+            /* unlink way and insert it before the head */
+            next[prev[way]] = next[way];
+            if (cache->lru_tail[set] == way) {
+                cache->lru_tail[set] = prev[way];
+            } else {
+                prev[next[way]] = prev[way];
+            }
+            next[way] = head;
+            prev[head] = way;
+            cache->lru_head[set] = way;
+            break;
+        }
+        case plru_replacement: {
+            /* point every node on the path from the root to way away from way */
+            uint64_t *bits = &cache->plru_bits[set * cache->plru_words];
+            if (cache->plru_words == 1) {
+                bits[0] = (bits[0] & ~cache->plru_path_mask[way]) | cache->plru_path_bits[way];
+                break;
+            }
+            for (uint64_t node = way + cache->ways; node > 1; node >>= 1) {
+                uint64_t parent = node >> 1;
+                uint64_t mask = 1ULL << (parent & 63);
+                bits[parent >> 6] = (bits[parent >> 6] & ~mask) | (mask & -(~node & 1));
+            }
+            break;
+        }
+        case random_replacement:
+            break;
+    }
+}
+
+static inline __attribute__((always_inline)) uint32_t
+pick_victim(cache_t *cache, uint64_t set, const replacement_t replacement) {
+    switch (replacement) {
+        case fifo_replacement: {
+            uint32_t way = cache->fifo_pointer[set];
+            cache->fifo_pointer[set] = way + 1 == cache->ways ? 0 : way + 1;
+            return way;
+        }
+        case lru_stack_replacement:
+            return (uint32_t) (cache->lru_stack[set] >> (4 * (cache->ways - 1))) & 0xf;
+        case lru_list_replacement:
+            return cache->lru_tail[set];
+        case plru_replacement: {
+            /* follow the direction bits from the root to a leaf */
+            const uint64_t *bits = &cache->plru_bits[set * cache->plru_words];
+            uint64_t node = 1;
+            while (node < cache->ways) {
+                node = 2 * node + ((bits[node >> 6] >> (node & 63)) & 1);
+            }
+            return (uint32_t) (node - cache->ways);
+        }
+        case random_replacement: {
+            /* xorshift64* */
+            uint64_t x = cache->random_state;
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            cache->random_state = x;
+            return (uint32_t) (((x * 0x2545F4914F6CDD1DULL) >> 32) * cache->ways >> 32);
+        }
+    }
+    return 0;
+}
+
+/* Results of a cache access */
+#define CACHE_MISS 0
+#define CACHE_HIT 1
+#define CACHE_EVICT 2   // miss that evicted a valid block
+
+/**
+ * Simulates an access to a single cache
+ *
+ * Always inlined with a constant lookup and replacement, so every kernel only contains their code
+ * @param cache the accessed cache
+ * @param address memory address of the access
+ * @param lookup lookup of the cache
+ * @param replacement replacement of the cache
+ * @param victim set to the address of the evicted block on CACHE_EVICT
+ * @return CACHE_HIT, CACHE_MISS or CACHE_EVICT
+ */
+static inline __attribute__((always_inline)) int
+access_cache(cache_t *cache, uint32_t address, const lookup_t lookup, const replacement_t replacement,
+             uint32_t *victim) {
+    uint32_t block = address >> cache->offset_bits;
+    uint64_t set = block & cache->set_mask;
+    tag_t tag = (tag_t) ((uint64_t) block >> cache->set_bits);
+    tag_t *set_tags = &cache->tags[set * cache->stride];
+
+    if (lookup == direct_lookup) {
+        /* check if the cache at set has the same tag (invalid blocks never match) => cache hit */
+        if (set_tags[0] == tag) {
+            return CACHE_HIT;
+        }
+        /* tags are not the same or set is not valid => cache miss */
+        int result = CACHE_MISS;
+        if (set_tags[0] != INVALID_TAG) {
+            *victim = (uint32_t) ((((uint64_t) set_tags[0] << cache->set_bits) | set) << cache->offset_bits);
+            result = CACHE_EVICT;
+        }
+        set_tags[0] = tag;
+        return result;
+    }
+
+    /* find the way holding the tag */
+    int64_t way = -1;
+    if (lookup == linear_lookup) {
+        for (uint32_t w = 0; w < cache->ways; w++) {
+            if (set_tags[w] == tag) {
+                way = w;
+                break;
+            }
+        }
+    } else if (lookup == scan_lookup) {
+        way = scan_tags(set_tags, cache->stride, tag);
+    } else {
+        way = index_find(cache, block);
+        if (way >= 0) {
+            way -= (int64_t) (set * cache->stride);
+        }
+    }
+    if (way >= 0) {
+        touch_way(cache, set, (uint32_t) way, replacement);
+        return CACHE_HIT;
+    }
+
+    /* cache miss. Fill the next invalid way or evict the way picked by the policy */
+    int result = CACHE_MISS;
+    if (cache->filled[set] < cache->ways) {
+        way = cache->filled[set]++;
+        if (set_tags[way] != INVALID_TAG) {
+            /* a block of the set has been invalidated, fill its way instead */
+            way = 0;
+            while (set_tags[way] != INVALID_TAG) {
+                way++;
+            }
+        }
+    } else {
+        way = pick_victim(cache, set, replacement);
+        uint32_t victim_block = (uint32_t) (((uint64_t) set_tags[way] << cache->set_bits) | set);
+        *victim = victim_block << cache->offset_bits;
+        result = CACHE_EVICT;
+        if (lookup == index_lookup) {
+            index_remove(cache, victim_block);
+        }
+    }
+    set_tags[way] = tag;
+    if (lookup == index_lookup) {
+        index_insert(cache, block, set * cache->stride + way);
+    }
+    touch_way(cache, set, (uint32_t) way, replacement);
+    return result;
+}
+
+/**
+ * Finds the way holding a block without touching the replacement state
+ * @param cache cache to search
+ * @param address any address within the block
+ * @return the way within the set of the block or -1 if the block is not cached
+ */
+static int64_t find_way(const cache_t *cache, uint32_t address) {
+    uint32_t block = address >> cache->offset_bits;
+    uint64_t set = block & cache->set_mask;
+    tag_t tag = (tag_t) ((uint64_t) block >> cache->set_bits);
+    const tag_t *set_tags = &cache->tags[set * cache->stride];
+
+    if (cache->lookup == index_lookup) {
+        int64_t position = index_find(cache, block);
+        return position < 0 ? -1 : position - (int64_t) (set * cache->stride);
+    }
+    for (uint32_t w = 0; w < cache->ways; w++) {
+        if (set_tags[w] == tag) {
+            return w;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Removes a block from a cache, e.g. because a lower level of an inclusive hierarchy evicted it
+ * @param cache cache holding the block
+ * @param address any address within the block
+ * @return 1 if the block was cached, 0 otherwise
+ */
+static int invalidate_block(cache_t *cache, uint32_t address) {
+    int64_t way = find_way(cache, address);
+    if (way < 0) {
+        return 0;
+    }
+    uint32_t block = address >> cache->offset_bits;
+    uint64_t set = block & cache->set_mask;
+    if (cache->lookup == index_lookup) {
+        index_remove(cache, block);
+    }
+    /* the replacement state keeps the way, the next miss of the set fills it before evicting anything */
+    cache->tags[set * cache->stride + way] = INVALID_TAG;
+    if (cache->lookup != direct_lookup) {
+        cache->filled[set]--;
+    }
+    return 1;
+}
+
+/**
+ * Body of the level kernels, which simulate a lower level of a hierarchy (L2, L3)
+ *
+ * In an inclusive hierarchy the missed blocks are looked up and filled on a miss, the victims are
+ * returned so they can be invalidated in the levels above. In an exclusive hierarchy a hit moves the block
+ * up into the level above and the victim of the level above moves down into this level.
+ * @param cache cache of the level
+ * @param misses misses of the level above in access order
+ * @param count number of misses
+ * @param forwarded misses and victims of this level, at most count records
+ * @param inclusion inclusion policy of the hierarchy
+ * @return number of forwarded records
+ */
+static inline __attribute__((always_inline)) uint64_t
+run_level(cache_t *cache, const miss_t *misses, uint64_t count, miss_t *forwarded, inclusion_t inclusion,
+          const lookup_t lookup, const replacement_t replacement) {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t evicts = 0;
+    uint64_t forwarded_count = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        miss_t forward = {NO_ADDRESS, NO_ADDRESS};
+        uint32_t victim;
+        if (misses[i].address != NO_ADDRESS) {
+            lookups++;
+            if (inclusion == inclusive) {
+                int result = access_cache(cache, misses[i].address, lookup, replacement, &victim);
+                hits += result & CACHE_HIT;
+                if (result != CACHE_HIT) {
+                    forward.address = misses[i].address;
+                }
+                if (result == CACHE_EVICT) {
+                    forward.victim = victim;
+                    evicts++;
+                }
+            } else if (invalidate_block(cache, misses[i].address)) {
+                hits++;
+            } else {
+                forward.address = misses[i].address;
+            }
+        }
+        if (inclusion == exclusive && misses[i].victim != NO_ADDRESS) {
+            if (access_cache(cache, misses[i].victim, lookup, replacement, &victim) == CACHE_EVICT) {
+                forward.victim = victim;
+                evicts++;
+            }
+        }
+        if (forward.address != NO_ADDRESS || forward.victim != NO_ADDRESS) {
+            forwarded[forwarded_count++] = forward;
+        }
+    }
+    cache->statistics.accesses += lookups;
+    cache->statistics.hits += hits;
+    cache->statistics.evicts += evicts;
+    return forwarded_count;
+}
+
+/**
+ * Passes a miss of the first level down an inclusive hierarchy right away
+ *
+ * The blocks a lower level evicts are invalidated in the levels above before the next access, so the
+ * first level never hits a block that is no longer in the levels below, and the results do not depend
+ * on how the accesses are split into batches.
+ * @param sim simulation with an inclusive hierarchy
+ * @param miss the miss, its victim is ignored
+ */
+static void forward_inclusive_miss(simulation_t *sim, const miss_t *miss) {
+    miss_t records[2] = {*miss};
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        const miss_t *in = &records[(level - 1) & 1];
+        miss_t *forwarded = &records[level & 1];
+        if (!sim->level_kernels[level - 1](sim->levels[level - 1], in, 1, forwarded, inclusive)) {
+            return;
+        }
+        if (forwarded->victim == NO_ADDRESS) {
+            continue;
+        }
+        for (unsigned int above = 1; above < level; above++) {
+            invalidate_block(sim->levels[above - 1], forwarded->victim);
+        }
+        invalidate_block(sim->caches[instruction], forwarded->victim);
+        if (sim->caches[data] != sim->caches[instruction]) {
+            invalidate_block(sim->caches[data], forwarded->victim);
+        }
+    }
+}
+
+/* Miss classification
+ *
+ * The misses of a cache are split into the three Cs like Hill's definition: compulsory misses are
+ * accesses to blocks that were never accessed before, capacity misses are the other misses of a fully
+ * associative LRU cache of the same size (the shadow cache), and conflict misses are the remaining
+ * misses of the simulated cache. A cache that does worse than LRU on some accesses can have fewer
+ * misses than its shadow cache, so the conflict misses can be negative. Repeats merged by the run
+ * filter hit the most recently used block of the shadow cache, so they are skipped.
+ *
+ * The kernels access the shadow caches in the same loop as the simulated caches, and keep their fill
+ * counts and LRU stacks in locals during a batch. Only shadow caches with an index are accessed out of line.
+ */
+
+/* Finds a tag among the first count tags of a set, inlined unlike scan_tags. SSE2 needs no dispatch */
+static inline __attribute__((always_inline)) int64_t find_tag(const tag_t *tags, uint32_t count, tag_t tag) {
+#ifdef __SSE2__
+    if (count % 4 == 0 && count <= 16) {
+        /* the whole set in one mask, no branch per group */
+        const __m128i probe = _mm_set1_epi32((int32_t) tag);
+        int mask = 0;
+        for (uint32_t i = 0; i < count; i += 4) {
+            __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &tags[i]), probe);
+            mask |= _mm_movemask_ps(_mm_castsi128_ps(equal)) << i;
+        }
+        return mask ? __builtin_ctz(mask) : -1;
+    }
+    if (count % 8 == 0) {
+        return scan_tags_sse2(tags, count, tag);
+    }
+#endif
+    for (uint32_t i = 0; i < count; i++) {
+        if (tags[i] == tag) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Accesses a shadow cache without an index like access_cache
+ *
+ * A shadow cache of at most LRU_STACK_LIMIT blocks uses the LRU stack, which the kernel passes in
+ * a local, larger ones use the LRU list of the cache.
+ * @param shadow the shadow cache, it has a single set
+ * @param block block address of the access, the tag of a single set
+ * @param stack LRU stack of a shadow cache with the LRU stack
+ * @param filled number of filled ways of the shadow cache
+ * @param replacement replacement of the shadow cache
+ * @return 1 on a hit, 0 on a miss
+ */
+static inline __attribute__((always_inline)) int
+access_shadow(cache_t *shadow, uint32_t block, uint64_t *stack, uint32_t *filled, const replacement_t replacement) {
+    int64_t way = find_tag(shadow->tags, shadow->stride, block);
+    int hit = way >= 0;
+    if (!hit) {
+        if (*filled < shadow->ways) {
+            way = (*filled)++;
+        } else if (replacement == lru_stack_replacement) {
+            way = (uint32_t) (*stack >> (4 * (shadow->ways - 1))) & 0xf;
+        } else {
+            way = pick_victim(shadow, 0, replacement);
+        }
+        shadow->tags[way] = block;
+    }
+    if (replacement == lru_stack_replacement) {
+        *stack = lru_stack_touch(*stack, (uint32_t) way);
+    } else {
+        touch_way(shadow, 0, (uint32_t) way, replacement);
+    }
+    return hit;
+}
+
+/* Accesses a shadow cache with an index, which is too large to be inlined into the kernels */
+static int access_indexed_shadow(cache_t *shadow, uint32_t address) {
+    uint32_t victim;
+    return access_cache(shadow, address, index_lookup, lru_list_replacement, &victim) == CACHE_HIT;
+}
+
+/* Marks a block as accessed, a block that was never accessed before is a compulsory miss */
+static inline int first_access(uint64_t *seen, uint32_t block) {
+    uint64_t bit = 1ULL << (block & 63);
+    uint64_t *word = &seen[block >> 6];
+    if (*word & bit) {
+        return 0;
+    }
+    *word |= bit;
+    return 1;
+}
+
+/* Body of the kernels, specialised for every lookup, replacement and organization,
+ * whether the misses are forwarded to a lower level and whether they are classified */
+static inline __attribute__((always_inline)) void
+run_batch(simulation_t *sim, const mem_access_t *accesses, uint64_t count,
+          const lookup_t lookup, const replacement_t replacement, const cache_org_t org, const int forward,
+          const int classify) {
+    uint64_t access_count[2] = {count, 0};
+    uint64_t hits[2] = {0, 0};
+    uint64_t evicts[2] = {0, 0};
+    uint64_t repeats[2] = {0, 0};
+    miss_t *misses = sim->misses[0];
+    uint64_t miss_count = 0;
+    const uint32_t block_mask = ~(uint32_t) (sim->config.block_size - 1);
+    const int inclusive_levels = forward && sim->level_count > 1 && sim->config.inclusion == inclusive;
+    if (org == sc) {
+        access_count[instruction] = 0;
+    }
+    uint64_t shadow_misses[2] = {0, 0};
+    uint64_t compulsory[2] = {0, 0};
+    uint64_t shadow_stack[2] = {0, 0};
+    uint32_t shadow_filled[2] = {0, 0};
+    const unsigned int offset_bits = sim->caches[instruction]->offset_bits;
+    const lookup_t shadow_lookup = classify ? sim->shadows[instruction]->lookup : direct_lookup;
+    const replacement_t shadow_replacement = classify ? sim->shadows[instruction]->replacement : lru_stack_replacement;
+    if (classify && shadow_lookup != index_lookup) {
+        for (int side = instruction; side <= (org == uc ? instruction : data); side++) {
+            shadow_stack[side] = shadow_replacement == lru_stack_replacement ? sim->shadows[side]->lru_stack[0] : 0;
+            shadow_filled[side] = sim->shadows[side]->filled[0];
+        }
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        /* a split cache uses the cache of the access type */
+        access_t side = org == uc ? instruction : accesses[i].accesstype;
+        uint32_t victim;
+        int result = access_cache(sim->caches[side], accesses[i].address, lookup, replacement, &victim);
+        if (org == sc) {
+            access_count[side]++;
+        }
+        hits[side] += result & CACHE_HIT;
+        evicts[side] += result >> 1;
+        repeats[side] += accesses[i].repeats;
+        if (classify) {
+            /* the shadow caches have a single set, the block address is their tag */
+            cache_t *shadow = sim->shadows[side];
+            uint32_t block = accesses[i].address >> offset_bits;
+            int shadow_hit;
+            if (shadow_lookup == index_lookup) {
+                shadow_hit = access_indexed_shadow(shadow, accesses[i].address);
+            } else if (shadow_replacement == lru_stack_replacement) {
+                shadow_hit = access_shadow(shadow, block, &shadow_stack[side], &shadow_filled[side],
+                                           lru_stack_replacement);
+            } else {
+                shadow_hit = access_shadow(shadow, block, &shadow_stack[side], &shadow_filled[side],
+                                           lru_list_replacement);
+            }
+            if (!shadow_hit) {
+                shadow_misses[side]++;
+                compulsory[side] += first_access(sim->seen[side], block);
+            }
+        }
+        /* an exclusive hierarchy forwards the misses to the next level after the batch, an inclusive
+         * one at once, its lower levels invalidate blocks of this level */
+        if (forward && result != CACHE_HIT) {
+            misses[miss_count].address = accesses[i].address & block_mask;
+            misses[miss_count].victim = result == CACHE_EVICT ? victim : NO_ADDRESS;
+            if (inclusive_levels) {
+                forward_inclusive_miss(sim, &misses[miss_count]);
+            }
+            miss_count++;
+        }
+    }
+    sim->miss_count = miss_count;
+    for (int side = instruction; side <= (org == uc ? instruction : data); side++) {
+        /* the merged repeats of a record are hits */
+        access_count[side] += repeats[side];
+        hits[side] += repeats[side];
+        sim->caches[side]->statistics.accesses += access_count[side];
+        sim->caches[side]->statistics.hits += hits[side];
+        sim->caches[side]->statistics.evicts += evicts[side];
+        sim->statistics.accesses += access_count[side];
+        sim->statistics.hits += hits[side];
+        sim->statistics.evicts += evicts[side];
+        if (classify) {
+            if (shadow_lookup != index_lookup) {
+                sim->shadows[side]->filled[0] = shadow_filled[side];
+                if (shadow_replacement == lru_stack_replacement) {
+                    sim->shadows[side]->lru_stack[0] = shadow_stack[side];
+                }
+            }
+            sim->caches[side]->statistics.compulsory += compulsory[side];
+            sim->caches[side]->statistics.capacity += shadow_misses[side] - compulsory[side];
+            sim->statistics.compulsory += compulsory[side];
+            sim->statistics.capacity += shadow_misses[side] - compulsory[side];
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void
+run_kernel(simulation_t *sim, const mem_access_t *accesses, uint64_t count,
+           const lookup_t lookup, const replacement_t replacement, const cache_org_t org) {
+    if (sim->misses[0]) {
+        if (sim->shadows[instruction]) {
+            run_batch(sim, accesses, count, lookup, replacement, org, 1, 1);
+        } else {
+            run_batch(sim, accesses, count, lookup, replacement, org, 1, 0);
+        }
+    } else if (sim->shadows[instruction]) {
+        run_batch(sim, accesses, count, lookup, replacement, org, 0, 1);
+    } else {
+        run_batch(sim, accesses, count, lookup, replacement, org, 0, 0);
+    }
+}
+
+#define DEFINE_KERNEL(lookup, replacement, org)                                                          \
+    static void kernel_##lookup##_##replacement##_##org(simulation_t *sim, const mem_access_t *accesses, \
+                                                         uint64_t count) {                                \
+        run_kernel(sim, accesses, count, lookup##_lookup, replacement##_replacement, org);               \
+    }
+#define DEFINE_LEVEL_KERNEL(lookup, replacement)                                                          \
+    static uint64_t level_kernel_##lookup##_##replacement(cache_t *cache, const miss_t *misses, uint64_t count, \
+                                                          miss_t *forwarded, inclusion_t inclusion) {        \
+        return run_level(cache, misses, count, forwarded, inclusion, lookup##_lookup, replacement##_replacement); \
+    }
+#define DEFINE_KERNELS(lookup, replacement) \
+    DEFINE_KERNEL(lookup, replacement, uc)  \
+    DEFINE_KERNEL(lookup, replacement, sc)  \
+    DEFINE_LEVEL_KERNEL(lookup, replacement)
+#define DEFINE_LOOKUP_KERNELS(lookup)     \
+    DEFINE_KERNELS(lookup, fifo)          \
+    DEFINE_KERNELS(lookup, lru_stack)     \
+    DEFINE_KERNELS(lookup, lru_list)      \
+    DEFINE_KERNELS(lookup, plru)          \
+    DEFINE_KERNELS(lookup, random)
+
+DEFINE_LOOKUP_KERNELS(direct)
+DEFINE_LOOKUP_KERNELS(linear)
+DEFINE_LOOKUP_KERNELS(scan)
+DEFINE_LOOKUP_KERNELS(index)
+
+#define KERNEL_ENTRY(lookup, replacement) \
+    [replacement##_replacement] = {[uc] = kernel_##lookup##_##replacement##_uc, [sc] = kernel_##lookup##_##replacement##_sc}
+#define LOOKUP_ENTRIES(lookup)                                                                      \
+    [lookup##_lookup] = {KERNEL_ENTRY(lookup, fifo), KERNEL_ENTRY(lookup, lru_stack), KERNEL_ENTRY(lookup, lru_list), \
+                         KERNEL_ENTRY(lookup, plru), KERNEL_ENTRY(lookup, random)}
+
+static const access_kernel_t kernels[4][5][2] = {
+        LOOKUP_ENTRIES(direct),
+        LOOKUP_ENTRIES(linear),
+        LOOKUP_ENTRIES(scan),
+        LOOKUP_ENTRIES(index),
+};
+
+#define LEVEL_KERNEL_ENTRY(lookup, replacement) [replacement##_replacement] = level_kernel_##lookup##_##replacement
+#define LEVEL_LOOKUP_ENTRIES(lookup)                                                                              \
+    [lookup##_lookup] = {LEVEL_KERNEL_ENTRY(lookup, fifo), LEVEL_KERNEL_ENTRY(lookup, lru_stack),                  \
+                         LEVEL_KERNEL_ENTRY(lookup, lru_list), LEVEL_KERNEL_ENTRY(lookup, plru),                  \
+                         LEVEL_KERNEL_ENTRY(lookup, random)}
+
+static const level_kernel_t level_kernels[4][5] = {
+        LEVEL_LOOKUP_ENTRIES(direct),
+        LEVEL_LOOKUP_ENTRIES(linear),
+        LEVEL_LOOKUP_ENTRIES(scan),
+        LEVEL_LOOKUP_ENTRIES(index),
+};
+
+/* Names of the configuration values, as used on the command line */
+const char *const mapping_names[] = {[dm] = "dm", [fa] = "fa", [sa] = "sa"};
+const char *const org_names[] = {[uc] = "uc", [sc] = "sc"};
+const char *const policy_names[] = {[fifo] = "fifo", [lru] = "lru", [plru] = "plru", [rnd] = "random"};
+const char *const inclusion_names[] = {[inclusive] = "inclusive", [exclusive] = "exclusive"};
+
+/* Parses a cache mapping name, returns 0 on success */
+int parse_mapping(const char *name, cache_map_t *mapping) {
+    for (cache_map_t m = dm; m <= sa; m++) {
+        if (strcmp(name, mapping_names[m]) == 0) {
+            *mapping = m;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parses a cache organization name, returns 0 on success */
+int parse_org(const char *name, cache_org_t *org) {
+    for (cache_org_t o = uc; o <= sc; o++) {
+        if (strcmp(name, org_names[o]) == 0) {
+            *org = o;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parses a replacement policy name, returns 0 on success */
+int parse_policy(const char *name, cache_policy_t *policy) {
+    for (cache_policy_t p = fifo; p <= rnd; p++) {
+        if (strcmp(name, policy_names[p]) == 0) {
+            *policy = p;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parses an inclusion policy name, returns 0 on success */
+int parse_inclusion(const char *name, inclusion_t *inclusion) {
+    for (inclusion_t p = inclusive; p <= exclusive; p++) {
+        if (strcmp(name, inclusion_names[p]) == 0) {
+            *inclusion = p;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Computes the geometry of the first level caches of a configuration
+ * @param config the configuration
+ * @param block_count set to the number of blocks of each first level cache
+ * @param ways set to the number of ways of the first level caches
+ */
+void cache_geometry(const cache_config_t *config, uint64_t *block_count, uint32_t *ways) {
+    uint32_t size = config->org == uc ? config->cache_size : config->cache_size / 2;
+    *block_count = size / config->block_size;
+    *ways = 1;
+    switch (config->mapping) {
+        case dm:
+            break;
+        case fa:
+            *ways = (uint32_t) *block_count;
+            break;
+        case sa:
+            *ways = config->ways;
+            break;
+    }
+}
+
+/**
+ * Checks whether a configuration describes a cache that can be simulated
+ * @param config configuration to check
+ * @return NULL if the configuration is valid, otherwise a description of the problem
+ */
+const char *validate_config(const cache_config_t *config) {
+    uint64_t block_count;
+    uint32_t ways;
+    cache_geometry(config, &block_count, &ways);
+    for (unsigned int level = 0; level < MAX_LEVELS; level++) {
+        if (level > 0) {
+            if (config->level_sizes[level - 1] == 0) {
+                /* an L3 needs an L2 */
+                if (level < MAX_LEVELS - 1 && config->level_sizes[level]) {
+                    return "lower level without the level above it";
+                }
+                continue;
+            }
+            block_count = config->level_sizes[level - 1] / config->block_size;
+            ways = config->level_ways[level - 1];
+        }
+        if (block_count == 0) {
+            return "cache is smaller than a block";
+        }
+        if (ways == 0 || block_count % ways != 0) {
+            return "number of blocks is not a multiple of the number of ways";
+        }
+        if ((block_count / ways) & (block_count / ways - 1)) {
+            return "number of sets is not a power of two";
+        }
+        if (config->policy == plru && (ways & (ways - 1))) {
+            return "PLRU needs a power of two number of ways";
+        }
+        if (config->sample_sets > 1 && block_count / ways < config->sample_sets) {
+            return "fewer sets than the sampling factor";
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Selects the sets of a sampled simulation
+ * @param sim simulation with all levels initialised
+ * @return the sample or NULL if no set is selected
+ */
+static set_sample_t *init_set_sample(const simulation_t *sim) {
+    const cache_config_t *config = &sim->config;
+    set_sample_t *sample = calloc(1, sizeof(set_sample_t));
+    sample->key_count = sim->caches[instruction]->set_count;
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        if (sim->levels[level - 1]->set_count < sample->key_count) {
+            sample->key_count = sim->levels[level - 1]->set_count;
+        }
+    }
+    sample->key_mask = sample->key_count - 1;
+    sample->offset_bits = sim->caches[instruction]->offset_bits;
+    sample->keys = calloc((sample->key_count + 63) / 64, sizeof(uint64_t));
+    for (uint64_t key = 0; key < sample->key_count; key++) {
+        uint64_t selector = config->sample_hash ? (key * 0x9E3779B97F4A7C15ULL) >> 32 : key;
+        if (selector % config->sample_sets == 0) {
+            sample->keys[key >> 6] |= 1ULL << (key & 63);
+            sample->sampled++;
+        }
+    }
+    if (sample->sampled == 0) {
+        free(sample->keys);
+        free(sample);
+        return NULL;
+    }
+    sample->accesses = calloc(sample->key_count, sizeof(uint64_t));
+    sample->misses = calloc(sample->key_count, sizeof(uint64_t));
+    return sample;
+}
+
+/**
+ * Creates a simulation with empty caches for the given configuration
+ * @param config cache configuration to simulate, see validate_config
+ * @return the simulation, to be freed with free_simulation
+ */
+simulation_t *init_simulation(const cache_config_t *config) {
+    simulation_t *sim = malloc(sizeof(simulation_t));
+    uint64_t block_count;
+    uint32_t ways;
+    cache_geometry(config, &block_count, &ways);
+    sim->config = *config;
+    memset(&sim->statistics, 0, sizeof(cache_stat_t));
+    sim->warmup_accesses = 0;
+    sim->caches[instruction] = init_cache(block_count, config->block_size, ways, config->policy);
+    if (config->org == uc) {
+        sim->caches[data] = sim->caches[instruction];
+    } else {
+        sim->caches[data] = init_cache(block_count, config->block_size, ways, config->policy);
+    }
+
+    /* both halves of a split cache have the same geometry, hence the same kernel */
+    pthread_once(&scan_tags_once, init_tag_scan);
+    cache_t *cache = sim->caches[instruction];
+    sim->kernel = kernels[cache->lookup][cache->replacement][config->org];
+
+    /* the shadow caches have as many ways as blocks, large ones use the index and the LRU list */
+    memset(sim->shadows, 0, sizeof(sim->shadows));
+    memset(sim->seen, 0, sizeof(sim->seen));
+    if (config->classify) {
+        uint64_t seen_words = ((1ULL << (ADDRESS_BITS - cache->offset_bits)) + 63) / 64;
+        for (int side = instruction; side <= (config->org == uc ? instruction : data); side++) {
+            sim->shadows[side] = init_cache(block_count, config->block_size, (uint32_t) block_count, lru);
+            sim->seen[side] = calloc(seen_words, sizeof(uint64_t));
+        }
+    }
+
+    /* lower levels get one miss buffer each, a level never forwards more records than it receives */
+    sim->level_count = 1;
+    memset(sim->misses, 0, sizeof(sim->misses));
+    sim->miss_count = 0;
+    while (sim->level_count < MAX_LEVELS && config->level_sizes[sim->level_count - 1]) {
+        unsigned int level = sim->level_count - 1;
+        cache = init_cache(config->level_sizes[level] / config->block_size, config->block_size, config->level_ways[level],
+                           config->policy);
+        sim->levels[level] = cache;
+        sim->level_kernels[level] = level_kernels[cache->lookup][cache->replacement];
+        sim->level_count++;
+    }
+
+    /* a sampled simulation counts the first level misses per set from the miss buffer */
+    sim->sample = NULL;
+    if (config->sample_sets > 1) {
+        sim->sample = init_set_sample(sim);
+    }
+    if (sim->level_count > 1 || sim->sample) {
+        for (unsigned int level = 0; level < sim->level_count; level++) {
+            sim->misses[level] = malloc(ACCESS_BATCH_SIZE * sizeof(miss_t));
+        }
+    }
+    return sim;
+}
+
+/**
+ * Frees a simulation and its caches
+ * @param sim simulation to free
+ */
+void free_simulation(simulation_t *sim) {
+    if (sim->caches[data] != sim->caches[instruction]) {
+        free_cache(sim->caches[data]);
+    }
+    free_cache(sim->caches[instruction]);
+    for (int side = instruction; side <= data; side++) {
+        if (sim->shadows[side]) {
+            free_cache(sim->shadows[side]);
+        }
+        free(sim->seen[side]);
+    }
+    for (unsigned int level = 0; level < sim->level_count; level++) {
+        if (level > 0) {
+            free_cache(sim->levels[level - 1]);
+        }
+        free(sim->misses[level]);
+    }
+    if (sim->sample) {
+        free(sim->sample->keys);
+        free(sim->sample->accesses);
+        free(sim->sample->misses);
+        free(sim->sample);
+    }
+    free(sim);
+}
+
+/**
+ * Passes the misses of the first level in the current batch down an exclusive hierarchy
+ *
+ * Every level handles the whole batch of records from the level above before the next level
+ * runs. The levels of an exclusive hierarchy never change the levels above, so this gives the same
+ * results as passing every miss down at once (see forward_inclusive_miss).
+ * @param sim simulation with at least two levels
+ */
+static void forward_misses(simulation_t *sim) {
+    uint64_t count = sim->miss_count;
+    for (unsigned int level = 1; level < sim->level_count && count; level++) {
+        count = sim->level_kernels[level - 1](sim->levels[level - 1], sim->misses[level - 1], count,
+                                              sim->misses[level], exclusive);
+    }
+}
+
+/* Counts the accesses and first level misses of the sampled sets in a batch */
+static void count_sampled_sets(simulation_t *sim, const mem_access_t *accesses, uint64_t count) {
+    set_sample_t *sample = sim->sample;
+    for (uint64_t i = 0; i < count; i++) {
+        sample->accesses[(accesses[i].address >> sample->offset_bits) & sample->key_mask] += 1 + accesses[i].repeats;
+    }
+    for (uint64_t i = 0; i < sim->miss_count; i++) {
+        sample->misses[(sim->misses[0][i].address >> sample->offset_bits) & sample->key_mask]++;
+    }
+}
+
+/**
+ * Simulates a batch of memory accesses
+ * @param sim simulation the accesses belong to
+ * @param accesses the memory accesses in trace order
+ * @param count number of accesses
+ */
+void simulate_accesses(simulation_t *sim, const mem_access_t *accesses, uint64_t count) {
+    if (sim->level_count == 1 && !sim->sample) {
+        sim->kernel(sim, accesses, count);
+        return;
+    }
+    /* the miss buffers hold the misses of at most one batch */
+    for (uint64_t start = 0; start < count; start += ACCESS_BATCH_SIZE) {
+        uint64_t batch_count = count - start < ACCESS_BATCH_SIZE ? count - start : ACCESS_BATCH_SIZE;
+        sim->kernel(sim, &accesses[start], batch_count);
+        if (sim->sample) {
+            count_sampled_sets(sim, &accesses[start], batch_count);
+        }
+        if (sim->level_count > 1 && sim->config.inclusion == exclusive) {
+            forward_misses(sim);
+        }
+    }
+}
+
+/**
+ * Estimates the statistics of all sets from the sampled sets
+ *
+ * Every counter is scaled by the inverse of the sampled fraction of the sets. The hit rate is a ratio
+ * estimate over the sampled sets, its confidence interval follows from the variance of the misses
+ * per set around the estimate (cluster sampling without replacement).
+ * @param sim sampled simulation after the whole trace has been simulated
+ */
+void finish_sampling(simulation_t *sim) {
+    set_sample_t *sample = sim->sample;
+    uint64_t accesses = 0;
+    uint64_t misses = 0;
+    for (uint64_t key = 0; key < sample->key_count; key++) {
+        accesses += sample->accesses[key];
+        misses += sample->misses[key];
+    }
+    double miss_rate = accesses ? (double) misses / (double) accesses : 0.0;
+    sample->hit_rate = 1.0 - miss_rate;
+    sample->margin = NAN;
+    if (sample->sampled > 1 && accesses) {
+        double n = (double) sample->sampled;
+        double squares = 0;
+        for (uint64_t key = 0; key < sample->key_count; key++) {
+            if (sample_access(sample, (uint32_t) (key << sample->offset_bits))) {
+                double residual = (double) sample->misses[key] - miss_rate * (double) sample->accesses[key];
+                squares += residual * residual;
+            }
+        }
+        double mean_accesses = (double) accesses / n;
+        double variance = (1.0 - n / (double) sample->key_count) * squares / (n - 1) /
+                          (n * mean_accesses * mean_accesses);
+        sample->margin = 1.96 * sqrt(variance);
+    }
+
+    double scale = (double) sample->key_count / (double) sample->sampled;
+    cache_stat_t *counters[2 + MAX_LEVELS] = {&sim->statistics, &sim->caches[instruction]->statistics};
+    unsigned int counter_count = 2;
+    if (sim->config.org == sc) {
+        counters[counter_count++] = &sim->caches[data]->statistics;
+    }
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        counters[counter_count++] = &sim->levels[level - 1]->statistics;
+    }
+    for (unsigned int i = 0; i < counter_count; i++) {
+        counters[i]->accesses = (uint64_t) llround((double) counters[i]->accesses * scale);
+        counters[i]->hits = (uint64_t) llround((double) counters[i]->hits * scale);
+        counters[i]->evicts = (uint64_t) llround((double) counters[i]->evicts * scale);
+    }
+}
+
+/**
+ * Estimates the average memory access time of a simulation: every access pays the latency of the
+ * first level, every miss of a level the latency of the level below, and misses of the last level
+ * the memory latency
+ * @param sim the simulation
+ * @return the average memory access time in cycles
+ */
+double average_access_time(const simulation_t *sim) {
+    if (sim->statistics.accesses == 0) {
+        return 0.0;
+    }
+    double cycles = (double) sim->statistics.accesses * sim->config.latencies[0];
+    uint64_t misses = sim->statistics.accesses - sim->statistics.hits;
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        const cache_stat_t *stats = &sim->levels[level - 1]->statistics;
+        cycles += (double) stats->accesses * sim->config.latencies[level];
+        misses = stats->accesses - stats->hits;
+    }
+    cycles += (double) misses * sim->config.latencies[MAX_LEVELS];
+    return cycles / (double) sim->statistics.accesses;
+}
+
+/* Statistics snapshots
+ *
+ * A snapshot holds the counters of every cache of a simulation at one point of the trace. The interval
+ * statistics are the differences of consecutive snapshots, and the snapshot taken at the end of the
+ * warm-up window is subtracted from the final statistics.
+ */
+
+/**
+ * Copies the current counters of a simulation
+ * @param sim the simulation
+ * @param snapshot snapshot to fill
+ */
+void take_snapshot(const simulation_t *sim, stat_snapshot_t *snapshot) {
+    memset(snapshot, 0, sizeof(stat_snapshot_t));
+    snapshot->accesses = sim->statistics.accesses;
+    snapshot->caches[instruction] = sim->caches[instruction]->statistics;
+    if (sim->config.org == sc) {
+        snapshot->caches[data] = sim->caches[data]->statistics;
+    }
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        snapshot->levels[level - 1] = sim->levels[level - 1]->statistics;
+    }
+}
+
+/**
+ * Subtracts earlier counters of a cache from its current counters
+ * @param stats current counters, replaced by the difference
+ * @param earlier counters of the same cache at an earlier point of the trace
+ */
+void subtract_statistics(cache_stat_t *stats, const cache_stat_t *earlier) {
+    stats->accesses -= earlier->accesses;
+    stats->hits -= earlier->hits;
+    stats->evicts -= earlier->evicts;
+    stats->compulsory -= earlier->compulsory;
+    stats->capacity -= earlier->capacity;
+}
+
+/**
+ * Removes the accesses of the warm-up window from every counter of a simulation
+ * @param sim the simulation
+ * @param warmup snapshot taken at the end of the warm-up window
+ */
+void exclude_warmup(simulation_t *sim, const stat_snapshot_t *warmup) {
+    for (int side = instruction; side <= (sim->config.org == uc ? instruction : data); side++) {
+        subtract_statistics(&sim->caches[side]->statistics, &warmup->caches[side]);
+        subtract_statistics(&sim->statistics, &warmup->caches[side]);
+    }
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        subtract_statistics(&sim->levels[level - 1]->statistics, &warmup->levels[level - 1]);
+    }
+    sim->warmup_accesses = warmup->accesses;
+}
+
+/**
+ * Returns the number of warm-up accesses removed from the statistics by exclude_warmup
+ * @param sim the simulation
+ * @return the number of excluded accesses, 0 without warm-up
+ */
+uint64_t warmup_accesses(const simulation_t *sim) {
+    return sim->warmup_accesses;
+}
+
+/**
+ * Clears every counter of a simulation but keeps the contents and the replacement state of its caches,
+ * e.g. to simulate another trace on warm caches
+ * @param sim the simulation
+ */
+void clear_statistics(simulation_t *sim) {
+    memset(&sim->statistics, 0, sizeof(cache_stat_t));
+    sim->warmup_accesses = 0;
+    for (int side = instruction; side <= data; side++) {
+        memset(&sim->caches[side]->statistics, 0, sizeof(cache_stat_t));
+        if (sim->shadows[side]) {
+            memset(&sim->shadows[side]->statistics, 0, sizeof(cache_stat_t));
+        }
+    }
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        memset(&sim->levels[level - 1]->statistics, 0, sizeof(cache_stat_t));
+    }
+    if (sim->sample) {
+        memset(sim->sample->accesses, 0, sim->sample->key_count * sizeof(uint64_t));
+        memset(sim->sample->misses, 0, sim->sample->key_count * sizeof(uint64_t));
+    }
+}
+
+/* Simulation images
+ *
+ * The state of a simulation between two batches is saved as an image: a magic and the configuration
+ * followed by the counters, the tags and the replacement state of every cache, the blocks seen by the
+ * miss classification and the counters of the sampled sets, in host byte order. Everything else is
+ * derived from the configuration, the hash index of a cache is rebuilt from its tags on restore.
+ */
+#define SIMULATION_IMAGE_MAGIC "CSIMIMG1"
+#define SIMULATION_IMAGE_MAGIC_LEN 8
+
+/* An array of the state of a simulation */
+typedef struct {
+    void *data;
+    size_t size;
+} state_array_t;
+
+/* At most 8 arrays per cache, 6 caches and 6 arrays of the simulation */
+#define MAX_STATE_ARRAYS 64
+
+/* Lists the arrays holding the state of a cache, returns their number */
+static unsigned int cache_state(cache_t *cache, state_array_t *arrays) {
+    unsigned int n = 0;
+    arrays[n++] = (state_array_t) {&cache->statistics, sizeof(cache_stat_t)};
+    arrays[n++] = (state_array_t) {cache->tags, cache->set_count * cache->stride * sizeof(tag_t)};
+    arrays[n++] = (state_array_t) {cache->filled, cache->set_count * sizeof(uint32_t)};
+    switch (cache->replacement) {
+        case fifo_replacement:
+            arrays[n++] = (state_array_t) {cache->fifo_pointer, cache->set_count * sizeof(uint32_t)};
+            break;
+        case lru_stack_replacement:
+            arrays[n++] = (state_array_t) {cache->lru_stack, cache->set_count * sizeof(uint64_t)};
+            break;
+        case lru_list_replacement:
+            arrays[n++] = (state_array_t) {cache->lru_prev, cache->block_count * sizeof(uint32_t)};
+            arrays[n++] = (state_array_t) {cache->lru_next, cache->block_count * sizeof(uint32_t)};
+            arrays[n++] = (state_array_t) {cache->lru_head, cache->set_count * sizeof(uint32_t)};
+            arrays[n++] = (state_array_t) {cache->lru_tail, cache->set_count * sizeof(uint32_t)};
+            break;
+        case plru_replacement:
+            arrays[n++] = (state_array_t) {cache->plru_bits, cache->set_count * cache->plru_words * sizeof(uint64_t)};
+            break;
+        case random_replacement:
+            arrays[n++] = (state_array_t) {&cache->random_state, sizeof(uint64_t)};
+            break;
+    }
+    return n;
+}
+
+/* Lists the arrays holding the state of a simulation in image order, returns their number */
+static unsigned int simulation_state(simulation_t *sim, state_array_t *arrays) {
+    unsigned int n = 0;
+    arrays[n++] = (state_array_t) {&sim->statistics, sizeof(cache_stat_t)};
+    arrays[n++] = (state_array_t) {&sim->warmup_accesses, sizeof(uint64_t)};
+    for (int side = instruction; side <= (sim->config.org == uc ? instruction : data); side++) {
+        n += cache_state(sim->caches[side], &arrays[n]);
+    }
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        n += cache_state(sim->levels[level - 1], &arrays[n]);
+    }
+    for (int side = instruction; side <= data; side++) {
+        if (sim->shadows[side]) {
+            uint64_t seen_words = ((1ULL << (ADDRESS_BITS - sim->shadows[side]->offset_bits)) + 63) / 64;
+            n += cache_state(sim->shadows[side], &arrays[n]);
+            arrays[n++] = (state_array_t) {sim->seen[side], seen_words * sizeof(uint64_t)};
+        }
+    }
+    if (sim->sample) {
+        arrays[n++] = (state_array_t) {sim->sample->accesses, sim->sample->key_count * sizeof(uint64_t)};
+        arrays[n++] = (state_array_t) {sim->sample->misses, sim->sample->key_count * sizeof(uint64_t)};
+    }
+    assert(n <= MAX_STATE_ARRAYS);
+    return n;
+}
+
+/* Indexes the valid blocks of a cache whose tags have been restored, tag t of set s is block t << set_bits | s */
+static void rebuild_index(cache_t *cache) {
+    if (cache->lookup != index_lookup) {
+        return;
+    }
+    memset(cache->index, 0, (cache->index_mask + 1) * sizeof(index_entry_t));
+    for (uint64_t position = 0; position < cache->set_count * cache->stride; position++) {
+        if (cache->tags[position] != INVALID_TAG) {
+            uint64_t set = position / cache->stride;
+            index_insert(cache, (uint32_t) (((uint64_t) cache->tags[position] << cache->set_bits) | set), position);
+        }
+    }
+}
+
+/**
+ * Returns the size of the image of a simulation, which only depends on its configuration
+ * @param sim the simulation
+ * @return size of the image in bytes
+ */
+size_t simulation_image_size(const simulation_t *sim) {
+    state_array_t arrays[MAX_STATE_ARRAYS];
+    /* the state is only read */
+    unsigned int count = simulation_state((simulation_t *) sim, arrays);
+    size_t size = SIMULATION_IMAGE_MAGIC_LEN + sizeof(cache_config_t);
+    for (unsigned int i = 0; i < count; i++) {
+        size += arrays[i].size;
+    }
+    return size;
+}
+
+/**
+ * Copies the state of a simulation into an image
+ * @param sim the simulation, between two batches
+ * @param image buffer of simulation_image_size bytes
+ */
+void save_simulation(const simulation_t *sim, void *image) {
+    state_array_t arrays[MAX_STATE_ARRAYS];
+    unsigned int count = simulation_state((simulation_t *) sim, arrays);
+    char *pos = image;
+    memcpy(pos, SIMULATION_IMAGE_MAGIC, SIMULATION_IMAGE_MAGIC_LEN);
+    pos += SIMULATION_IMAGE_MAGIC_LEN;
+    memcpy(pos, &sim->config, sizeof(cache_config_t));
+    pos += sizeof(cache_config_t);
+    for (unsigned int i = 0; i < count; i++) {
+        memcpy(pos, arrays[i].data, arrays[i].size);
+        pos += arrays[i].size;
+    }
+}
+
+/**
+ * Replaces the state of a simulation by an image saved by a simulation of the same configuration
+ * @param sim the simulation
+ * @param image the image
+ * @param size size of the image in bytes
+ * @return NULL on success, otherwise a description of the problem, the simulation is unchanged then
+ */
+const char *restore_simulation(simulation_t *sim, const void *image, size_t size) {
+    const char *pos = image;
+    if (size < SIMULATION_IMAGE_MAGIC_LEN + sizeof(cache_config_t) ||
+        memcmp(pos, SIMULATION_IMAGE_MAGIC, SIMULATION_IMAGE_MAGIC_LEN) != 0) {
+        return "not a simulation image";
+    }
+    if (memcmp(pos + SIMULATION_IMAGE_MAGIC_LEN, &sim->config, sizeof(cache_config_t)) != 0) {
+        return "the image was saved by a different cache configuration";
+    }
+    if (size != simulation_image_size(sim)) {
+        return "the image is truncated";
+    }
+    pos += SIMULATION_IMAGE_MAGIC_LEN + sizeof(cache_config_t);
+
+    state_array_t arrays[MAX_STATE_ARRAYS];
+    unsigned int count = simulation_state(sim, arrays);
+    for (unsigned int i = 0; i < count; i++) {
+        memcpy(arrays[i].data, pos, arrays[i].size);
+        pos += arrays[i].size;
+    }
+
+    for (int side = instruction; side <= (sim->config.org == uc ? instruction : data); side++) {
+        rebuild_index(sim->caches[side]);
+        if (sim->shadows[side]) {
+            rebuild_index(sim->shadows[side]);
+        }
+    }
+    for (unsigned int level = 1; level < sim->level_count; level++) {
+        rebuild_index(sim->levels[level - 1]);
+    }
+    return NULL;
+}
+
+/* Accessors
+ *
+ * The simulation is opaque to its users, they read its configuration, statistics and geometry here.
+ */
+
+/**
+ * Returns the configuration a simulation was created with
+ * @param sim the simulation
+ * @return the configuration, valid until the simulation is freed
+ */
+const cache_config_t *simulation_config(const simulation_t *sim) {
+    return &sim->config;
+}
+
+/**
+ * Returns the statistics of the first level, the sum of both halves of a split cache
+ * @param sim the simulation
+ * @return the statistics
+ */
+cache_stat_t simulation_statistics(const simulation_t *sim) {
+    return sim->statistics;
+}
+
+/**
+ * Returns the number of levels of a simulation
+ * @param sim the simulation
+ * @return 1 without lower levels, up to MAX_LEVELS
+ */
+unsigned int simulation_levels(const simulation_t *sim) {
+    return sim->level_count;
+}
+
+/**
+ * Describes one cache of a simulation
+ * @param sim the simulation
+ * @param level level of the cache, 0 for the first level
+ * @param side half of a split first level cache, ignored for unified caches and lower levels
+ * @return the geometry and statistics of the cache
+ */
+cache_info_t get_cache_info(const simulation_t *sim, unsigned int level, access_t side) {
+    assert(level < sim->level_count);
+    const cache_t *cache = level == 0 ? sim->caches[side] : sim->levels[level - 1];
+    cache_info_t info = {
+            .set_count = cache->set_count,
+            .ways = cache->ways,
+            .offset_bits = cache->offset_bits,
+            .set_bits = cache->set_bits,
+            .tag_bits = ADDRESS_BITS - cache->offset_bits - cache->set_bits,
+            .statistics = cache->statistics,
+    };
+    return info;
+}
+
+/**
+ * Returns the sampled sets of a simulation, which the accesses can be checked against with
+ * sample_access before they are passed to simulate_accesses
+ * @param sim the simulation
+ * @return the sampled sets or NULL if every set is simulated
+ */
+const set_sample_t *simulation_sample(const simulation_t *sim) {
+    return sim->sample;
+}
+
+/**
+ * Returns the hit rate estimate of a sampled simulation, see finish_sampling
+ * @param sim the simulation
+ * @param estimate estimate to fill
+ * @return 1 if the simulation is sampled, 0 otherwise
+ */
+int get_sample_estimate(const simulation_t *sim, sample_estimate_t *estimate) {
+    if (!sim->sample) {
+        return 0;
+    }
+    estimate->sampled_sets = sim->sample->sampled;
+    estimate->set_count = sim->sample->key_count;
+    estimate->hit_rate = sim->sample->hit_rate;
+    estimate->margin = sim->sample->margin;
+    return 1;
+}
+
+/* Multi-core simulation
+ *
+ * Every core has private first level caches, unified or split like the cache of a single core simulation,
+ * which are kept coherent with MESI by a directory. The directory holds the caches holding each cached
+ * block (the sharers) and whether a single cache holds it exclusively (E) or modified (M), blocks with
+ * several sharers are shared (S) and blocks a cache does not hold are invalid (I) in that cache.
+ *
+ * The accesses are simulated in epochs of two phases. In the first phase the cores access their private
+ * caches in parallel, a pool of worker threads each simulating a subset of the cores, and record their
+ * coherence events: misses and writes to blocks they did not hold modified. The directory is only read
+ * in this phase. In the second phase a single thread applies the events of all cores in trace order to
+ * the directory, which downgrades or invalidates the copies of the other cores. A core therefore notices
+ * the writes of other cores only at the end of an epoch, e.g. its reads of a block that another core
+ * wrote earlier in the same epoch still hit, and shorter epochs make the simulation more accurate.
+ */
+
+/* Coherence events, recorded by the cores in the first phase of an epoch */
+typedef enum {
+    read_miss,      // the other copies become shared
+    write_miss,     // the other copies are invalidated
+    write_hit       // write to a block that was not modified at the start of the epoch, an E copy becomes
+                    // M, an S copy is upgraded by invalidating the other copies
+} coherence_event_kind_t;
+
+typedef struct {
+    uint64_t position;      // index of the access in the epoch
+    uint32_t address;       // block aligned address of the access
+    uint32_t victim;        // block evicted by a miss or NO_ADDRESS
+    access_t side;
+    coherence_event_kind_t kind;
+} coherence_event_t;
+
+/* Directory entry of a block held by at least one cache. The cache of access type t of core c is sharer
+ * bit 2 * c + t, entries without sharers are free. */
+typedef struct {
+    uint64_t sharers;
+    uint32_t block;
+    uint8_t exclusive;      // the single sharer holds the block in E or M
+    uint8_t modified;       // the single sharer holds the block in M
+} directory_entry_t;
+
+/* State of a core, written by a single worker in the first phase of an epoch */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) cache_t *caches[2];   // cache per access type, both point to the same cache for a unified cache
+    cache_t *invalidated[2];    // blocks invalidated by another core and not missed since, see record_invalidation
+    coherence_event_t *events;  // events of the current epoch in access order
+    uint64_t event_count;
+    uint64_t sharing_misses;
+    uint64_t invalidations;
+    uint64_t upgrades;
+    uint64_t writebacks;
+} core_t;
+
+/* Simulates the accesses of an epoch to the caches of the cores of a worker */
+typedef void (*core_kernel_t)(multicore_t *mc, unsigned int worker, const core_access_t *accesses, uint64_t count);
+
+typedef struct {
+    multicore_t *mc;
+    unsigned int index;
+} core_worker_t;
+
+struct multicore {
+    cache_config_t config;
+    unsigned int core_count;
+    core_t *cores;
+    core_kernel_t kernel;
+    uint64_t epoch;                 // accesses per epoch
+    unsigned int offset_bits;
+    /* open addressing hash table from block address to directory entry */
+    directory_entry_t *directory;
+    uint64_t directory_mask;
+    unsigned int directory_shift;
+    /* worker threads, worker w simulates the cores c with c % thread_count == w, the calling thread is worker 0 */
+    unsigned int thread_count;
+    pthread_t *threads;
+    core_worker_t *workers;
+    pthread_barrier_t epoch_start;
+    pthread_barrier_t epoch_end;
+    const core_access_t *epoch_accesses;
+    uint64_t epoch_count;
+    int stopping;
+};
+
+static inline uint64_t sharer_bit(unsigned int core, access_t side) {
+    return 1ULL << (2 * core + side);
+}
+
+/* Position of a block address in the directory (fibonacci hashing) */
+static inline uint64_t directory_home(const multicore_t *mc, uint32_t block) {
+    return ((uint64_t) block * 0x9E3779B97F4A7C15ULL) >> mc->directory_shift;
+}
+
+/* Returns the directory entry of a block or NULL if no cache holds the block */
+static inline directory_entry_t *directory_find(const multicore_t *mc, uint32_t block) {
+    uint64_t pos = directory_home(mc, block);
+    while (mc->directory[pos].sharers != 0) {
+        if (mc->directory[pos].block == block) {
+            return &mc->directory[pos];
+        }
+        pos = (pos + 1) & mc->directory_mask;
+    }
+    return NULL;
+}
+
+/* Returns the directory entry of a block, a free entry that takes the block once it gets a sharer if no
+ * cache holds the block. Every cached block has an entry, so the table never fills up. */
+static directory_entry_t *directory_entry(multicore_t *mc, uint32_t block) {
+    uint64_t pos = directory_home(mc, block);
+    while (mc->directory[pos].sharers != 0) {
+        if (mc->directory[pos].block == block) {
+            return &mc->directory[pos];
+        }
+        pos = (pos + 1) & mc->directory_mask;
+    }
+    directory_entry_t *entry = &mc->directory[pos];
+    entry->block = block;
+    entry->exclusive = 0;
+    entry->modified = 0;
+    return entry;
+}
+
+/* Frees an entry without sharers, the following entries of the probe sequence are shifted back like in index_remove */
+static void directory_remove(multicore_t *mc, directory_entry_t *entry) {
+    uint64_t pos = (uint64_t) (entry - mc->directory);
+    uint64_t next = pos;
+    while (1) {
+        next = (next + 1) & mc->directory_mask;
+        directory_entry_t moved = mc->directory[next];
+        if (moved.sharers == 0) {
+            break;
+        }
+        uint64_t home = directory_home(mc, moved.block);
+        if (((next - home) & mc->directory_mask) >= ((next - pos) & mc->directory_mask)) {
+            mc->directory[pos] = moved;
+            pos = next;
+        }
+    }
+    mc->directory[pos].sharers = 0;
+}
+
+/* Body of the core kernels, specialised for every lookup and replacement */
+static inline __attribute__((always_inline)) void
+run_cores(multicore_t *mc, unsigned int worker, const core_access_t *accesses, uint64_t count,
+          const lookup_t lookup, const replacement_t replacement) {
+    const uint32_t block_mask = ~(uint32_t) (mc->config.block_size - 1);
+    for (uint64_t i = 0; i < count; i++) {
+        unsigned int id = accesses[i].core;
+        if (id % mc->thread_count != worker) {
+            continue;
+        }
+        core_t *core = &mc->cores[id];
+        access_t side = mc->config.org == uc ? instruction : accesses[i].access.accesstype;
+        cache_t *cache = core->caches[side];
+        uint32_t address = accesses[i].access.address;
+        coherence_event_t event = {i, address & block_mask, NO_ADDRESS, side, read_miss};
+        int result = access_cache(cache, address, lookup, replacement, &event.victim);
+        cache->statistics.accesses++;
+        if (result == CACHE_HIT) {
+            cache->statistics.hits++;
+            if (!accesses[i].write) {
+                continue;
+            }
+            /* writes to blocks the core held modified at the start of the epoch need no coherence */
+            const directory_entry_t *entry = directory_find(mc, address >> mc->offset_bits);
+            if (entry && entry->modified && entry->sharers == sharer_bit(id, side)) {
+                continue;
+            }
+            event.kind = write_hit;
+        } else {
+            cache->statistics.evicts += result >> 1;
+            if (invalidate_block(core->invalidated[side], address)) {
+                core->sharing_misses++;
+            }
+            event.kind = accesses[i].write ? write_miss : read_miss;
+        }
+        core->events[core->event_count++] = event;
+    }
+}
+
+#define DEFINE_CORE_KERNEL(lookup, replacement)                                                                   \
+    static void core_kernel_##lookup##_##replacement(multicore_t *mc, unsigned int worker,                       \
+                                                      const core_access_t *accesses, uint64_t count) {            \
+        run_cores(mc, worker, accesses, count, lookup##_lookup, replacement##_replacement);                      \
+    }
+#define DEFINE_LOOKUP_CORE_KERNELS(lookup)     \
+    DEFINE_CORE_KERNEL(lookup, fifo)           \
+    DEFINE_CORE_KERNEL(lookup, lru_stack)      \
+    DEFINE_CORE_KERNEL(lookup, lru_list)       \
+    DEFINE_CORE_KERNEL(lookup, plru)           \
+    DEFINE_CORE_KERNEL(lookup, random)
+
+DEFINE_LOOKUP_CORE_KERNELS(direct)
+DEFINE_LOOKUP_CORE_KERNELS(linear)
+DEFINE_LOOKUP_CORE_KERNELS(scan)
+DEFINE_LOOKUP_CORE_KERNELS(index)
+
+#define CORE_KERNEL_ENTRY(lookup, replacement) [replacement##_replacement] = core_kernel_##lookup##_##replacement
+#define CORE_LOOKUP_ENTRIES(lookup)                                                                               \
+    [lookup##_lookup] = {CORE_KERNEL_ENTRY(lookup, fifo), CORE_KERNEL_ENTRY(lookup, lru_stack),                    \
+                         CORE_KERNEL_ENTRY(lookup, lru_list), CORE_KERNEL_ENTRY(lookup, plru),                    \
+                         CORE_KERNEL_ENTRY(lookup, random)}
+
+static const core_kernel_t core_kernels[4][5] = {
+        CORE_LOOKUP_ENTRIES(direct),
+        CORE_LOOKUP_ENTRIES(linear),
+        CORE_LOOKUP_ENTRIES(scan),
+        CORE_LOOKUP_ENTRIES(index),
+};
+
+/**
+ * Remembers that another core invalidated a block of a cache, so its next miss is a sharing miss
+ *
+ * The invalidated blocks are kept in a fully associative LRU cache of the same size as the cache,
+ * which drops the oldest ones. The second phase of an epoch only removes blocks from the caches, so
+ * the blocks invalidated during the current epoch are always kept.
+ * @param invalidated invalidated blocks of the cache
+ * @param address block aligned address of the block
+ */
+static void record_invalidation(cache_t *invalidated, uint32_t address) {
+    uint32_t victim;
+    switch (invalidated->lookup) {
+        case direct_lookup:
+            access_cache(invalidated, address, direct_lookup, lru_stack_replacement, &victim);
+            break;
+        case linear_lookup:
+            access_cache(invalidated, address, linear_lookup, lru_stack_replacement, &victim);
+            break;
+        case scan_lookup:
+            if (invalidated->replacement == lru_stack_replacement) {
+                access_cache(invalidated, address, scan_lookup, lru_stack_replacement, &victim);
+            } else {
+                access_cache(invalidated, address, scan_lookup, lru_list_replacement, &victim);
+            }
+            break;
+        case index_lookup:
+            access_cache(invalidated, address, index_lookup, lru_list_replacement, &victim);
+            break;
+    }
+}
+
+/**
+ * Invalidates the copies of a block held by other caches because a core writes it
+ * @param mc the simulation
+ * @param entry directory entry of the block
+ * @param others sharer bits of the copies to invalidate
+ * @param address block aligned address of the block
+ */
+static void invalidate_copies(multicore_t *mc, directory_entry_t *entry, uint64_t others, uint32_t address) {
+    entry->sharers &= ~others;
+    while (others) {
+        unsigned int bit = (unsigned int) __builtin_ctzll(others);
+        others &= others - 1;
+        core_t *core = &mc->cores[bit / 2];
+        access_t side = (access_t) (bit & 1);
+        /* a modified copy is written back before it is invalidated */
+        if (entry->modified) {
+            core->writebacks++;
+        }
+        /* the copy may already have been evicted later in the epoch */
+        if (invalidate_block(core->caches[side], address)) {
+            core->invalidations++;
+            record_invalidation(core->invalidated[side], address);
+        }
+    }
+    entry->exclusive = 0;
+    entry->modified = 0;
+}
+
+/**
+ * Applies a coherence event of a core to the directory and the caches of the other cores
+ *
+ * A cache becomes a sharer of the block unless another core invalidated its copy earlier in the epoch,
+ * so the directory lists exactly the caches holding a block at the end of the epoch.
+ * @param mc the simulation
+ * @param id core of the event
+ * @param event the event
+ */
+static void apply_event(multicore_t *mc, unsigned int id, const coherence_event_t *event) {
+    core_t *core = &mc->cores[id];
+    uint64_t self = sharer_bit(id, event->side);
+    uint32_t block = event->address >> mc->offset_bits;
+
+    /* the victim of a miss leaves the cache first, a modified victim is written back */
+    if (event->victim != NO_ADDRESS) {
+        directory_entry_t *victim = directory_find(mc, event->victim >> mc->offset_bits);
+        if (victim && (victim->sharers & self)) {
+            if (victim->modified) {
+                core->writebacks++;
+            }
+            victim->sharers &= ~self;
+            if (victim->sharers == 0) {
+                directory_remove(mc, victim);
+            }
+        }
+    }
+
+    directory_entry_t *entry = directory_entry(mc, block);
+    uint64_t others = entry->sharers & ~self;
+    if (event->kind == read_miss) {
+        /* an E or M copy of another core becomes shared, a modified one is written back */
+        if (others && entry->exclusive) {
+            if (entry->modified) {
+                mc->cores[__builtin_ctzll(others) / 2].writebacks++;
+            }
+            entry->exclusive = 0;
+            entry->modified = 0;
+        }
+    } else if (others) {
+        if (event->kind == write_hit && (entry->sharers & self)) {
+            core->upgrades++;
+        }
+        invalidate_copies(mc, entry, others, event->address);
+    }
+
+    int lost = find_way(core->invalidated[event->side], event->address) >= 0 &&
+               find_way(core->caches[event->side], event->address) < 0;
+    if (!lost) {
+        entry->sharers |= self;
+        if (entry->sharers == self) {
+            entry->exclusive = 1;
+            entry->modified |= event->kind != read_miss;
+        }
+    }
+    if (entry->sharers == 0) {
+        directory_remove(mc, entry);
+    }
+}
+
+/* Applies the events of all cores in access order, the positions of the events of different cores differ */
+static void apply_events(multicore_t *mc) {
+    uint64_t next[MAX_CORES] = {0};
+    while (1) {
+        unsigned int first = mc->core_count;
+        uint64_t position = UINT64_MAX;
+        for (unsigned int id = 0; id < mc->core_count; id++) {
+            const core_t *core = &mc->cores[id];
+            if (next[id] < core->event_count && core->events[next[id]].position < position) {
+                position = core->events[next[id]].position;
+                first = id;
+            }
+        }
+        if (first == mc->core_count) {
+            break;
+        }
+        apply_event(mc, first, &mc->cores[first].events[next[first]++]);
+    }
+    for (unsigned int id = 0; id < mc->core_count; id++) {
+        mc->cores[id].event_count = 0;
+    }
+}
+
+static void *core_worker(void *arg) {
+    core_worker_t *worker = arg;
+    multicore_t *mc = worker->mc;
+    while (1) {
+        pthread_barrier_wait(&mc->epoch_start);
+        if (mc->stopping) {
+            return NULL;
+        }
+        mc->kernel(mc, worker->index, mc->epoch_accesses, mc->epoch_count);
+        pthread_barrier_wait(&mc->epoch_end);
+    }
+}
+
+/**
+ * Checks whether a configuration can be simulated on several cores
+ * @param config configuration of the private caches of every core
+ * @param cores number of cores
+ * @return NULL if the configuration is valid, otherwise a description of the problem
+ */
+const char *validate_multicore(const cache_config_t *config, unsigned int cores) {
+    if (cores == 0 || cores > MAX_CORES) {
+        return "unsupported number of cores";
+    }
+    if (config->level_sizes[0] || config->classify || config->sample_sets > 1) {
+        return "lower levels, miss classification and sampling need a single core";
+    }
+    return validate_config(config);
+}
+
+/**
+ * Creates a multi-core simulation with empty caches
+ * @param config configuration of the private caches of every core, see validate_multicore
+ * @param cores number of cores
+ * @param threads number of worker threads, at most one per core is used
+ * @param epoch number of accesses per epoch, the accesses of all cores count
+ * @return the simulation, to be freed with free_multicore
+ */
+multicore_t *init_multicore(const cache_config_t *config, unsigned int cores, unsigned int threads, uint64_t epoch) {
+    multicore_t *mc = calloc(1, sizeof(multicore_t));
+    uint64_t block_count;
+    uint32_t ways;
+    cache_geometry(config, &block_count, &ways);
+    mc->config = *config;
+    mc->core_count = cores;
+    mc->epoch = epoch ? epoch : 1;
+    pthread_once(&scan_tags_once, init_tag_scan);
+
+    mc->cores = alloc_aligned(cores * sizeof(core_t));
+    memset(mc->cores, 0, cores * sizeof(core_t));
+    for (unsigned int id = 0; id < cores; id++) {
+        core_t *core = &mc->cores[id];
+        for (int side = instruction; side <= (config->org == uc ? instruction : data); side++) {
+            core->caches[side] = init_cache(block_count, config->block_size, ways, config->policy);
+            core->invalidated[side] = init_cache(block_count, config->block_size, (uint32_t) block_count, lru);
+        }
+        if (config->org == uc) {
+            core->caches[data] = core->caches[instruction];
+            core->invalidated[data] = core->invalidated[instruction];
+        }
+        core->events = malloc(mc->epoch * sizeof(coherence_event_t));
+    }
+    cache_t *cache = mc->cores[0].caches[instruction];
+    mc->offset_bits = cache->offset_bits;
+    mc->kernel = core_kernels[cache->lookup][cache->replacement];
+
+    /* keep the load factor of the directory at or below 1/2 */
+    uint64_t cached_blocks = block_count * cores * (config->org == uc ? 1 : 2);
+    unsigned int directory_bits = log2_int(2 * cached_blocks);
+    mc->directory = calloc(1ULL << directory_bits, sizeof(directory_entry_t));
+    mc->directory_mask = (1ULL << directory_bits) - 1;
+    mc->directory_shift = 64 - directory_bits;
+
+    mc->thread_count = threads == 0 ? 1 : threads > cores ? cores : threads;
+    if (mc->thread_count > 1) {
+        pthread_barrier_init(&mc->epoch_start, NULL, mc->thread_count);
+        pthread_barrier_init(&mc->epoch_end, NULL, mc->thread_count);
+        mc->threads = malloc(mc->thread_count * sizeof(pthread_t));
+        mc->workers = malloc(mc->thread_count * sizeof(core_worker_t));
+        for (unsigned int w = 1; w < mc->thread_count; w++) {
+            mc->workers[w].mc = mc;
+            mc->workers[w].index = w;
+            pthread_create(&mc->threads[w], NULL, core_worker, &mc->workers[w]);
+        }
+    }
+    return mc;
+}
+
+/**
+ * Stops the worker threads and frees a multi-core simulation
+ * @param mc simulation to free
+ */
+void free_multicore(multicore_t *mc) {
+    if (mc->thread_count > 1) {
+        mc->stopping = 1;
+        pthread_barrier_wait(&mc->epoch_start);
+        for (unsigned int w = 1; w < mc->thread_count; w++) {
+            pthread_join(mc->threads[w], NULL);
+        }
+        pthread_barrier_destroy(&mc->epoch_start);
+        pthread_barrier_destroy(&mc->epoch_end);
+        free(mc->threads);
+        free(mc->workers);
+    }
+    for (unsigned int id = 0; id < mc->core_count; id++) {
+        core_t *core = &mc->cores[id];
+        for (int side = instruction; side <= (mc->config.org == uc ? instruction : data); side++) {
+            free_cache(core->caches[side]);
+            free_cache(core->invalidated[side]);
+        }
+        free(core->events);
+    }
+    free(mc->cores);
+    free(mc->directory);
+    free(mc);
+}
+
+/**
+ * Simulates a batch of accesses of several cores
+ *
+ * The batch is split into epochs, an epoch never spans two batches.
+ * @param mc the simulation
+ * @param accesses the accesses of all cores in trace order, the core of every access must be below the number of cores
+ * @param count number of accesses
+ */
+void simulate_multicore(multicore_t *mc, const core_access_t *accesses, uint64_t count) {
+    for (uint64_t start = 0; start < count; start += mc->epoch) {
+        mc->epoch_accesses = &accesses[start];
+        mc->epoch_count = count - start < mc->epoch ? count - start : mc->epoch;
+        if (mc->thread_count > 1) {
+            pthread_barrier_wait(&mc->epoch_start);
+        }
+        mc->kernel(mc, 0, mc->epoch_accesses, mc->epoch_count);
+        if (mc->thread_count > 1) {
+            pthread_barrier_wait(&mc->epoch_end);
+        }
+        apply_events(mc);
+    }
+}
+
+/**
+ * Returns the statistics of one core of a multi-core simulation
+ * @param mc the simulation
+ * @param core number of the core
+ * @return the statistics of its caches and its coherence events
+ */
+core_stat_t get_core_statistics(const multicore_t *mc, unsigned int core) {
+    assert(core < mc->core_count);
+    const core_t *c = &mc->cores[core];
+    core_stat_t stats = {
+            .sharing_misses = c->sharing_misses,
+            .invalidations = c->invalidations,
+            .upgrades = c->upgrades,
+            .writebacks = c->writebacks,
+    };
+    stats.caches[instruction] = c->caches[instruction]->statistics;
+    if (mc->config.org == sc) {
+        stats.caches[data] = c->caches[data]->statistics;
+    }
+    return stats;
+}
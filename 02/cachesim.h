@@ -0,0 +1,184 @@
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* libcachesim
+ *
+ * Trace driven simulation of a unified or split first level cache with optional lower levels.
+ * A simulation is created from a cache_config_t and owns all of its caches, simulations share no
+ * state, so they may run on different threads. Accesses are simulated in batches, the statistics
+ * and the geometry of the caches are read back through the accessors below.
+ */
+
+typedef enum {
+    dm, fa, sa
+} cache_map_t;
+typedef enum {
+    uc, sc
+} cache_org_t;
+typedef enum {
+    instruction, data
+} access_t;
+typedef enum {
+    fifo, lru, plru, rnd // rnd: random replacement
+} cache_policy_t;
+typedef enum {
+    inclusive, // lower levels hold every block of the levels above
+    exclusive  // a block is held by a single level, victims move down a level
+} inclusion_t;
+
+typedef struct {
+    uint32_t address;
+    access_t accesstype;
+    uint32_t repeats;   // accesses to the same block merged into this one by a run filter, all of them hit, usually 0
+} mem_access_t;
+
+typedef struct {
+    uint64_t accesses;
+    uint64_t hits;
+    // You can declare additional statistics if
+    // you like, however you are now allowed to
+    // remove the accesses or hits
+    uint64_t evicts;
+    /* miss classification of the first level, only counted if the configuration sets classify */
+    uint64_t compulsory;    // misses of blocks that were never accessed before
+    uint64_t capacity;      // other misses of a fully associative LRU cache of the same size
+} cache_stat_t;
+
+/* Number of levels of a cache hierarchy, the first level is the (possibly split) cache above */
+#define MAX_LEVELS 3
+
+typedef struct {
+    uint32_t cache_size;
+    uint32_t block_size;
+    cache_map_t mapping;
+    cache_org_t org;
+    uint32_t ways;          // ways of a set associative cache
+    cache_policy_t policy;
+    /* unified, set associative lower levels (L2, L3) with the same block size and policy */
+    uint32_t level_sizes[MAX_LEVELS - 1];   // 0 if the level does not exist
+    uint32_t level_ways[MAX_LEVELS - 1];
+    inclusion_t inclusion;
+    uint32_t latencies[MAX_LEVELS + 1];     // hit latency of every level and the memory latency in cycles
+    int classify;           // classify the misses of the first level into compulsory, capacity and conflict
+    /* set sampling, only the accesses to a subset of the sets are simulated */
+    uint32_t sample_sets;   // simulate one in sample_sets sets, 0 or 1 to simulate every set
+    int sample_hash;        // pick the sets by a hash of the set index instead of every sample_sets-th set
+} cache_config_t;
+
+#define DEFAULT_BLOCK_SIZE 64
+
+/* Configuration options that are not given on the command line */
+#define DEFAULT_CONFIG                                                                                             \
+    {.block_size = DEFAULT_BLOCK_SIZE, .ways = 4, .policy = fifo, .level_ways = {8, 16}, .inclusion = inclusive, \
+     .latencies = {1, 10, 40, 200}}
+
+/* Number of accesses that are read before they are simulated */
+#define ACCESS_BATCH_SIZE 4096
+
+/* State of a single simulation */
+typedef struct simulation simulation_t;
+
+/* Sets simulated by a sampled simulation */
+typedef struct set_sample set_sample_t;
+
+/* Counters of every cache of a simulation at one point of the trace */
+typedef struct {
+    uint64_t accesses;                      // accesses simulated before the snapshot
+    cache_stat_t caches[2];                 // first level per access type, only instruction for a unified cache
+    cache_stat_t levels[MAX_LEVELS - 1];
+} stat_snapshot_t;
+
+/* Geometry and statistics of one cache of a simulation */
+typedef struct {
+    uint64_t set_count;
+    uint32_t ways;
+    unsigned int offset_bits;
+    unsigned int set_bits;
+    unsigned int tag_bits;
+    cache_stat_t statistics;
+} cache_info_t;
+
+/* Estimated hit rate of a sampled simulation */
+typedef struct {
+    uint64_t sampled_sets;
+    uint64_t set_count;
+    double hit_rate;
+    double margin;          // half width of the 95% confidence interval, NAN for a single sampled set
+} sample_estimate_t;
+
+/* Multi-core simulation, private first level caches per core kept coherent with MESI */
+typedef struct multicore multicore_t;
+
+/* Cores of a multi-core simulation, the directory keeps a bit per first level cache */
+#define MAX_CORES 32
+
+/* Access of a core in a multi-core trace */
+typedef struct {
+    mem_access_t access;    // repeats must be 0
+    uint32_t core;
+    int write;              // data access that modifies the block
+} core_access_t;
+
+/* Statistics of one core of a multi-core simulation */
+typedef struct {
+    cache_stat_t caches[2];     // first level per access type, only instruction for a unified cache
+    uint64_t sharing_misses;    // misses of blocks a write of another core invalidated, among the last as many
+                                // invalidated blocks as the cache holds
+    uint64_t invalidations;     // blocks of this core invalidated by writes of other cores
+    uint64_t upgrades;          // writes to shared blocks, which invalidated the other copies
+    uint64_t writebacks;        // modified blocks written back on eviction, invalidation or a read of another core
+} core_stat_t;
+
+/* Names of the configuration values and their parsers, which return 0 on success */
+extern const char *const mapping_names[];
+extern const char *const org_names[];
+extern const char *const policy_names[];
+extern const char *const inclusion_names[];
+int parse_mapping(const char *name, cache_map_t *mapping);
+int parse_org(const char *name, cache_org_t *org);
+int parse_policy(const char *name, cache_policy_t *policy);
+int parse_inclusion(const char *name, inclusion_t *inclusion);
+
+/* Creating and simulating */
+void cache_geometry(const cache_config_t *config, uint64_t *block_count, uint32_t *ways);
+const char *validate_config(const cache_config_t *config);
+simulation_t *init_simulation(const cache_config_t *config);
+void free_simulation(simulation_t *sim);
+void simulate_accesses(simulation_t *sim, const mem_access_t *accesses, uint64_t count);
+
+/* Statistics */
+const cache_config_t *simulation_config(const simulation_t *sim);
+cache_stat_t simulation_statistics(const simulation_t *sim);
+unsigned int simulation_levels(const simulation_t *sim);
+cache_info_t get_cache_info(const simulation_t *sim, unsigned int level, access_t side);
+double average_access_time(const simulation_t *sim);
+
+/* Warm-up and intervals */
+void take_snapshot(const simulation_t *sim, stat_snapshot_t *snapshot);
+void subtract_statistics(cache_stat_t *stats, const cache_stat_t *earlier);
+void exclude_warmup(simulation_t *sim, const stat_snapshot_t *warmup);
+uint64_t warmup_accesses(const simulation_t *sim);
+void clear_statistics(simulation_t *sim);
+
+/* Checkpoints, the state of a simulation between batches as an image in memory */
+size_t simulation_image_size(const simulation_t *sim);
+void save_simulation(const simulation_t *sim, void *image);
+const char *restore_simulation(simulation_t *sim, const void *image, size_t size);
+
+/* Set sampling */
+const set_sample_t *simulation_sample(const simulation_t *sim);
+int sample_access(const set_sample_t *sample, uint32_t address);
+void finish_sampling(simulation_t *sim);
+int get_sample_estimate(const simulation_t *sim, sample_estimate_t *estimate);
+
+/* Multi-core simulation */
+const char *validate_multicore(const cache_config_t *config, unsigned int cores);
+multicore_t *init_multicore(const cache_config_t *config, unsigned int cores, unsigned int threads, uint64_t epoch);
+void free_multicore(multicore_t *mc);
+void simulate_multicore(multicore_t *mc, const core_access_t *accesses, uint64_t count);
+core_stat_t get_core_statistics(const multicore_t *mc, unsigned int core);
+
+#endif
@@ -0,0 +1,16 @@
+# Checks that writing interval statistics does not change the final statistics of a hierarchy.
+# cmake -DCACHE_SIM=<cache_sim> -DTRACE=<trace> -DINCLUSION=inclusive|exclusive -DWORK_DIR=<dir> -P interval.cmake
+set(ARGS 256 sa sc --ways 2 --l2 512 --l2-ways 2 --l3 1024 --l3-ways 4 --policy lru
+        --inclusion ${INCLUSION} --file ${TRACE})
+
+execute_process(COMMAND ${CACHE_SIM} ${ARGS}
+        OUTPUT_VARIABLE WHOLE RESULT_VARIABLE WHOLE_RESULT)
+execute_process(COMMAND ${CACHE_SIM} ${ARGS} --interval 3 --interval-file ${WORK_DIR}/interval_${INCLUSION}.csv
+        OUTPUT_VARIABLE INTERVAL RESULT_VARIABLE INTERVAL_RESULT)
+
+if (NOT WHOLE_RESULT EQUAL 0 OR NOT INTERVAL_RESULT EQUAL 0)
+    message(FATAL_ERROR "cache_sim failed:\n${WHOLE}\n${INTERVAL}")
+endif ()
+if (NOT WHOLE STREQUAL INTERVAL)
+    message(FATAL_ERROR "statistics differ with --interval:\n${WHOLE}\n--- with --interval 3 ---\n${INTERVAL}")
+endif ()
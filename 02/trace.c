@@ -0,0 +1,838 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+/* Compressed traces need zlib (HAVE_ZLIB) or libzstd (HAVE_ZSTD), see CMakeLists.txt */
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "trace.h"
+
+typedef enum {
+    text, binary
+} trace_format_t;
+
+/* A memory mapped trace file. The records are parsed in place,
+ * pos always points to the first byte that has not been parsed yet.
+ *
+ * Traces that can not be mapped (stdin, pipes) are streamed: they are read in chunks
+ * into a buffer, and end is the end of the last complete record in the buffer.
+ */
+struct trace {
+    const char *data;
+    const char *pos;
+    const char *end;
+    size_t size;            // size of the file, bytes read so far for a streamed trace
+    int mapped;
+    trace_format_t format;
+    uint32_t last_address[2]; // previous address per access type (binary traces only)
+    /* streamed traces only */
+    int fd;                 // -1 once the whole trace has been read
+    char *buffer;
+    size_t buffer_size;
+    size_t buffered;        // bytes in buffer, the bytes after end belong to an incomplete record
+    struct decompressor *decompressor;  // thread feeding the stream, NULL for other streams
+    const char *error;      // why the trace ended early, NULL if it was read without errors
+};
+
+/* Size of the first read of a streamed trace, the buffer grows for longer lines */
+#define TRACE_CHUNK_SIZE (1 << 20)
+
+/* Binary traces start with this magic followed by one varint per access. The varint holds
+ * the zigzag encoded difference to the previous address of the same access type shifted
+ * left by one, the lowest bit is the access type.
+ */
+#define BINARY_TRACE_MAGIC "CSIMBIN1"
+#define BINARY_TRACE_MAGIC_LEN 8
+
+/* Value of a hex digit plus one, 0 marks characters that are no hex digits */
+static const uint8_t hex_lut[256] = {
+        ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+        ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+        ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+        ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/**
+ * Restarts reading at the first access of the trace, streamed traces only if trace_rewindable
+ * @param trace trace to rewind
+ */
+void rewind_trace(trace_t *trace) {
+    trace->pos = trace->data;
+    if (trace->format == binary) {
+        trace->pos += BINARY_TRACE_MAGIC_LEN;
+    }
+    trace->last_address[instruction] = 0;
+    trace->last_address[data] = 0;
+}
+
+static int decompression_failed(struct decompressor *decompressor);
+
+/* Sets end of a streamed trace to the end of the last complete record in its buffer */
+static void find_records_end(trace_t *trace) {
+    /* text records end with a newline, varints with a byte below 0x80 */
+    const char *end = trace->buffer + trace->buffered;
+    if (trace->format == text) {
+        while (end > trace->buffer && end[-1] != '\n') {
+            end--;
+        }
+    } else {
+        while (end > trace->buffer && (uint8_t) end[-1] >= 0x80) {
+            end--;
+        }
+    }
+    trace->end = end;
+}
+
+/**
+ * Reads more of a streamed trace into its buffer
+ *
+ * Once the buffer is full the incomplete record after end is moved to the start of the buffer,
+ * which drops the parsed records, until then the trace is appended. Then end is advanced
+ * to the end of the last complete record that has been read. At the end of the file end is the
+ * end of the buffer and fd is closed.
+ * @param trace streamed trace, all complete records must have been parsed
+ */
+static void refill_trace(trace_t *trace) {
+    if (trace->buffered == trace->buffer_size) {
+        size_t rest = trace->buffered - (size_t) (trace->pos - trace->buffer);
+        memmove(trace->buffer, trace->pos, rest);
+        trace->buffered = rest;
+        if (trace->buffered == trace->buffer_size) {
+            /* a single line fills the whole buffer */
+            trace->buffer_size *= 2;
+            trace->buffer = realloc(trace->buffer, trace->buffer_size);
+        }
+        trace->data = trace->buffer;
+        trace->pos = trace->buffer;
+    }
+
+    ssize_t n;
+    do {
+        n = read(trace->fd, trace->buffer + trace->buffered, trace->buffer_size - trace->buffered);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        /* the decompressor closes the pipe when it fails, the rest of the buffer is not parsed then */
+        if (n < 0) {
+            trace->error = "Unable to read the trace file";
+        } else if (trace->decompressor && decompression_failed(trace->decompressor)) {
+            trace->error = "Unable to decompress the trace file";
+        }
+        if (trace->fd != STDIN_FILENO) {
+            close(trace->fd);
+        }
+        trace->fd = -1;
+        trace->end = trace->error ? trace->pos : trace->buffer + trace->buffered;
+        return;
+    }
+    trace->buffered += (size_t) n;
+    trace->size += (size_t) n;
+    find_records_end(trace);
+}
+
+/**
+ * Opens a streamed trace and detects its format
+ * @param fd file descriptor of the trace
+ * @param head bytes already read from fd, they start the trace
+ * @param head_size number of bytes in head
+ * @param decompressor thread that writes into fd, NULL for other streams
+ * @return the opened trace
+ */
+static trace_t *open_stream(int fd, const uint8_t *head, size_t head_size, struct decompressor *decompressor) {
+    trace_t *trace = calloc(1, sizeof(trace_t));
+    trace->fd = fd;
+    trace->decompressor = decompressor;
+    trace->buffer_size = TRACE_CHUNK_SIZE;
+    trace->buffer = malloc(trace->buffer_size);
+    trace->data = trace->buffer;
+    trace->pos = trace->buffer;
+    trace->format = text;
+    memcpy(trace->buffer, head, head_size);
+    trace->buffered = head_size;
+    trace->size = head_size;
+
+    /* the format is known once the first bytes have been read */
+    while (trace->fd >= 0 && trace->buffered < BINARY_TRACE_MAGIC_LEN) {
+        refill_trace(trace);
+    }
+    if (trace->buffered >= BINARY_TRACE_MAGIC_LEN &&
+        memcmp(trace->buffer, BINARY_TRACE_MAGIC, BINARY_TRACE_MAGIC_LEN) == 0) {
+        trace->format = binary;
+        trace->pos = trace->buffer + BINARY_TRACE_MAGIC_LEN;
+        /* find the end of the last complete record again, the magic stays in the buffer for rewind_trace */
+        if (trace->fd >= 0) {
+            find_records_end(trace);
+        }
+    }
+    return trace;
+}
+
+/* Compressed traces
+ *
+ * A decompressor thread reads the compressed file and writes the decompressed trace in chunks
+ * into a pipe, which is streamed like any other pipe. Only a chunk of the trace is ever in memory.
+ */
+typedef enum {
+    uncompressed, gzip_compressed, zstd_compressed
+} compression_t;
+
+/* Length of the longest magic number, the first bytes of a trace that decide its compression */
+#define COMPRESSION_MAGIC_LEN 4
+
+typedef struct decompressor {
+    int in_fd;          // compressed file
+    int out_fd;         // write end of the pipe
+    compression_t compression;
+    uint8_t head[COMPRESSION_MAGIC_LEN];    // bytes already read from in_fd, they start the file
+    size_t head_size;
+    pthread_t thread;
+    atomic_int failed;  // set before the pipe is closed if the file could not be decompressed
+} decompressor_t;
+
+#define DECOMPRESS_CHUNK_SIZE (1 << 17)
+
+/* Checks whether a decompressor failed, valid once the pipe it writes has been closed */
+static int decompression_failed(struct decompressor *decompressor) {
+    return atomic_load(&decompressor->failed);
+}
+
+/* Detects the compression of a file from its first bytes */
+static compression_t detect_compression(const uint8_t *magic, size_t size) {
+    if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return gzip_compressed;
+    }
+    if (size == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return zstd_compressed;
+    }
+    return uncompressed;
+}
+
+/* Reads up to size bytes, less only at the end of the file. Returns the number of bytes or -1 on errors. */
+static ssize_t read_fully(int fd, void *buffer, size_t size) {
+    size_t len = 0;
+    while (len < size) {
+        ssize_t n = read(fd, (char *) buffer + len, size - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t) n;
+    }
+    return (ssize_t) len;
+}
+
+/* Reads the next chunk of the compressed file into in, the first chunk starts with the bytes already read */
+static ssize_t read_compressed(decompressor_t *decompressor, uint8_t *in) {
+    size_t len = decompressor->head_size;
+    memcpy(in, decompressor->head, len);
+    decompressor->head_size = 0;
+    ssize_t n;
+    do {
+        n = read(decompressor->in_fd, in + len, DECOMPRESS_CHUNK_SIZE - len);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? n : (ssize_t) len + n;
+}
+
+/* Writes a whole buffer into the pipe, returns 0 on success and 1 if the reader closed it */
+static int write_chunk(int fd, const void *data, size_t size) {
+    const char *pos = data;
+    while (size > 0) {
+        ssize_t n = write(fd, pos, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return 1;
+        }
+        pos += n;
+        size -= (size_t) n;
+    }
+    return 0;
+}
+
+static void *decompressor_thread(void *arg) {
+    decompressor_t *decompressor = arg;
+    int failed = 0;
+
+    /* a closed pipe ends the thread through EPIPE instead of terminating the process */
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+    uint8_t *in = malloc(DECOMPRESS_CHUNK_SIZE);
+    uint8_t *out = malloc(DECOMPRESS_CHUNK_SIZE);
+    int closed = 0;
+    ssize_t n = 0;
+    if (decompressor->compression == gzip_compressed) {
+#ifdef HAVE_ZLIB
+        /* 16 selects the gzip format, a member that ends is followed by the next one of a concatenated file */
+        z_stream stream = {0};
+        inflateInit2(&stream, 15 + 16);
+        int status = Z_OK;
+        while (!failed && !closed && (n = read_compressed(decompressor, in)) > 0) {
+            stream.next_in = in;
+            stream.avail_in = (uInt) n;
+            /* a full output buffer may leave output behind in the stream even without more input */
+            while (!failed && !closed &&
+                   (stream.avail_in > 0 || (stream.avail_out == 0 && status != Z_STREAM_END))) {
+                if (status == Z_STREAM_END) {
+                    inflateReset(&stream);
+                }
+                stream.next_out = out;
+                stream.avail_out = DECOMPRESS_CHUNK_SIZE;
+                status = inflate(&stream, Z_NO_FLUSH);
+                failed = status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR;
+                closed = !failed && write_chunk(decompressor->out_fd, out, DECOMPRESS_CHUNK_SIZE - stream.avail_out);
+            }
+        }
+        /* a truncated file ends inside a member */
+        failed |= n < 0 || (!closed && status != Z_STREAM_END);
+        inflateEnd(&stream);
+#endif
+    } else {
+#ifdef HAVE_ZSTD
+        ZSTD_DCtx *context = ZSTD_createDCtx();
+        size_t remaining = 0;   // non-zero while a frame is incomplete
+        while (!failed && !closed && (n = read_compressed(decompressor, in)) > 0) {
+            ZSTD_inBuffer input = {in, (size_t) n, 0};
+            while (!failed && !closed && input.pos < input.size) {
+                ZSTD_outBuffer output = {out, DECOMPRESS_CHUNK_SIZE, 0};
+                remaining = ZSTD_decompressStream(context, &output, &input);
+                failed = ZSTD_isError(remaining);
+                closed = !failed && write_chunk(decompressor->out_fd, out, output.pos);
+            }
+        }
+        failed |= n < 0 || (!closed && remaining != 0);
+        ZSTD_freeDCtx(context);
+#endif
+    }
+    /* the reader of the stream reports the failure once it reaches the end of the pipe */
+    atomic_store(&decompressor->failed, failed);
+    if (decompressor->in_fd != STDIN_FILENO) {
+        close(decompressor->in_fd);
+    }
+    free(in);
+    free(out);
+    close(decompressor->out_fd);
+    return NULL;
+}
+
+/**
+ * Starts a decompressor thread for a compressed trace
+ * @param fd compressed trace file, closed by the decompressor
+ * @param compression compression of the file
+ * @param head bytes already read from fd, they start the file
+ * @param head_size number of bytes in head, at most COMPRESSION_MAGIC_LEN
+ * @return the streamed trace or NULL if the compression is not supported by this build
+ */
+static trace_t *open_compressed(int fd, compression_t compression, const uint8_t *head, size_t head_size) {
+#ifndef HAVE_ZLIB
+    if (compression == gzip_compressed) {
+        printf("gzip compressed traces are not supported, cache_sim was built without zlib\n");
+        close(fd);
+        return NULL;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (compression == zstd_compressed) {
+        printf("zstd compressed traces are not supported, cache_sim was built without libzstd\n");
+        close(fd);
+        return NULL;
+    }
+#endif
+    int pipe_fds[2];
+    if (pipe(pipe_fds) < 0) {
+        close(fd);
+        return NULL;
+    }
+    decompressor_t *decompressor = malloc(sizeof(decompressor_t));
+    decompressor->in_fd = fd;
+    decompressor->out_fd = pipe_fds[1];
+    decompressor->compression = compression;
+    memcpy(decompressor->head, head, head_size);
+    decompressor->head_size = head_size;
+    atomic_init(&decompressor->failed, 0);
+    pthread_create(&decompressor->thread, NULL, decompressor_thread, decompressor);
+
+    return open_stream(pipe_fds[0], NULL, 0, decompressor);
+}
+
+/**
+ * Opens a trace file and maps it into memory
+ *
+ * Files that can not be mapped (e.g. empty files) are read into a heap buffer instead.
+ * Pipes, character devices and stdin (path "-") are streamed, gzip and zstd compressed
+ * files are decompressed by a separate thread into a stream.
+ * @param path path of the trace file
+ * @return the opened trace or NULL if the file could not be read
+ */
+trace_t *open_trace(const char *path) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return NULL;
+    }
+    /* the magic number of a stream can not be read again, it is handed on to the reader of the stream */
+    uint8_t magic[COMPRESSION_MAGIC_LEN];
+    ssize_t magic_size = S_ISREG(st.st_mode) ? pread(fd, magic, sizeof(magic), 0) : read_fully(fd, magic, sizeof(magic));
+    if (magic_size < 0) {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return NULL;
+    }
+    compression_t compression = detect_compression(magic, (size_t) magic_size);
+    if (!S_ISREG(st.st_mode)) {
+        return compression != uncompressed ? open_compressed(fd, compression, magic, (size_t) magic_size)
+                                           : open_stream(fd, magic, (size_t) magic_size, NULL);
+    }
+    if (compression != uncompressed) {
+        return open_compressed(fd, compression, NULL, 0);
+    }
+
+    trace_t *trace = malloc(sizeof(trace_t));
+    trace->size = (size_t) st.st_size;
+    trace->mapped = 0;
+    trace->fd = -1;
+    trace->error = NULL;
+    trace->buffer = NULL;
+    void *data = MAP_FAILED;
+    if (trace->size > 0) {
+        data = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (data != MAP_FAILED) {
+        madvise(data, trace->size, MADV_SEQUENTIAL);
+        trace->mapped = 1;
+    } else {
+        /* fall back to reading the whole file */
+        char *buf = malloc(trace->size + 1);
+        size_t len = 0;
+        ssize_t n;
+        while (len < trace->size && (n = read(fd, buf + len, trace->size - len)) > 0) {
+            len += (size_t) n;
+        }
+        trace->size = len;
+        data = buf;
+    }
+    close(fd);
+
+    trace->data = data;
+    trace->end = trace->data + trace->size;
+    trace->format = text;
+    if (trace->size >= BINARY_TRACE_MAGIC_LEN && memcmp(data, BINARY_TRACE_MAGIC, BINARY_TRACE_MAGIC_LEN) == 0) {
+        trace->format = binary;
+    }
+    rewind_trace(trace);
+    return trace;
+}
+
+/**
+ * Unmaps or closes the trace file and frees the trace
+ * @param trace trace returned by open_trace
+ */
+void close_trace(trace_t *trace) {
+    if (trace->buffer) {
+        if (trace->fd > STDIN_FILENO) {
+            close(trace->fd);
+        }
+        if (trace->decompressor) {
+            pthread_join(trace->decompressor->thread, NULL);
+            free(trace->decompressor);
+        }
+        free(trace->buffer);
+    } else if (trace->mapped) {
+        munmap((void *) trace->data, trace->size);
+    } else {
+        free((void *) trace->data);
+    }
+    free(trace);
+}
+
+/* Reads the next record of a text trace. Empty lines and lines starting with '/' or '#' are skipped.
+ * The fields of a multi-core trace after the address are parsed if core is not NULL, otherwise the
+ * rest of the line is ignored. */
+static inline __attribute__((always_inline)) int
+read_text_transaction(trace_t *trace, mem_access_t *access, uint32_t *core, int *write) {
+    const char *pos = trace->pos;
+    const char *end = trace->end;
+
+    while (1) {
+        /* skip whitespace and empty lines */
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) {
+            pos++;
+        }
+        if (pos == end) {
+            trace->pos = pos;
+            return 0;
+        }
+        if (*pos != '/' && *pos != '#') {
+            break;
+        }
+        /* skip comment lines */
+        pos = memchr(pos, '\n', end - pos);
+        if (!pos) {
+            pos = end;
+        }
+    }
+
+    /* Get the access type */
+    if (*pos == 'I') {
+        access->accesstype = instruction;
+    } else if (*pos == 'D') {
+        access->accesstype = data;
+    } else {
+        printf("Unknown access type\n");
+        exit(0);
+    }
+    pos++;
+    while (pos < end && (*pos == ' ' || *pos == '\t')) {
+        pos++;
+    }
+
+    /* Get the address */
+    if (end - pos > 2 && pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X')) {
+        pos += 2;
+    }
+    const char *digits = pos;
+    uint32_t address = 0;
+    uint8_t value;
+    while (pos < end && (value = hex_lut[(unsigned char) *pos])) {
+        address = (address << 4) | (value - 1);
+        pos++;
+    }
+    if (pos == digits) {
+        printf("Malformed address\n");
+        exit(0);
+    }
+    access->address = address;
+
+    /* an optional R or W, then an optional decimal core number */
+    if (core) {
+        *write = 0;
+        *core = 0;
+        while (pos < end && (*pos == ' ' || *pos == '\t')) {
+            pos++;
+        }
+        if (pos < end && (*pos == 'R' || *pos == 'W')) {
+            *write = *pos == 'W';
+            pos++;
+            while (pos < end && (*pos == ' ' || *pos == '\t')) {
+                pos++;
+            }
+        }
+        while (pos < end && *pos >= '0' && *pos <= '9') {
+            *core = *core * 10 + (uint32_t) (*pos - '0');
+            if (*core > UINT16_MAX) {
+                printf("Malformed core number\n");
+                exit(0);
+            }
+            pos++;
+        }
+    }
+
+    /* ignore the rest of the line */
+    if (pos < end && *pos != '\n') {
+        pos = memchr(pos, '\n', end - pos);
+        if (!pos) {
+            pos = end;
+        }
+    }
+    trace->pos = pos;
+    return 1;
+}
+
+/* Reads the next record of a binary trace */
+static int read_binary_transaction(trace_t *trace, mem_access_t *access) {
+    const uint8_t *pos = (const uint8_t *) trace->pos;
+    const uint8_t *end = (const uint8_t *) trace->end;
+    if (pos == end) {
+        return 0;
+    }
+
+    /* decode the varint */
+    uint64_t value;
+    if (end - pos >= 8) {
+        /* fast path: load 8 bytes at once and find the terminating byte */
+        uint64_t word;
+        memcpy(&word, pos, sizeof(word));
+        uint64_t stop_bits = ~word & 0x8080808080808080ULL;
+        unsigned int length = ((unsigned int) __builtin_ctzll(stop_bits | (1ULL << 63)) >> 3) + 1;
+        if (length > 5) {
+            printf("Malformed binary trace\n");
+            exit(0);
+        }
+        word &= ~0ULL >> (64 - 8 * length);
+        value = (word & 0x7f) | ((word & 0x7f00) >> 1) | ((word & 0x7f0000) >> 2) |
+                ((word & 0x7f000000) >> 3) | ((word & 0x7f00000000ULL) >> 4);
+        pos += length;
+    } else {
+        unsigned int shift = 0;
+        uint8_t byte;
+        value = 0;
+        do {
+            if (pos == end || shift > 28) {
+                printf("Malformed binary trace\n");
+                exit(0);
+            }
+            byte = *pos++;
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+    }
+
+    access_t type = (access_t) (value & 1);
+    uint32_t zigzag = (uint32_t) (value >> 1);
+    uint32_t delta = (zigzag >> 1) ^ -(zigzag & 1);
+    access->accesstype = type;
+    access->address = trace->last_address[type] + delta;
+    trace->last_address[type] = access->address;
+    trace->pos = (const char *) pos;
+    return 1;
+}
+
+/* Reads the next memory access from the trace and stores
+ * 1) access type (instruction or data access)
+ * 2) memory address
+ * in access. Returns 1 if an access was read and 0 if the end of the trace was reached.
+ */
+int read_transaction(trace_t *trace, mem_access_t *access) {
+    access->repeats = 0;
+    while (1) {
+        int found = trace->format == binary ? read_binary_transaction(trace, access)
+                                            : read_text_transaction(trace, access, NULL, NULL);
+        /* a streamed trace ran out of complete records, read the next chunk */
+        if (found || trace->fd < 0) {
+            return found;
+        }
+        refill_trace(trace);
+    }
+}
+
+/**
+ * Reads the next access of a multi-core trace
+ *
+ * A record of a multi-core text trace may follow the address with R (read, the default) or W (write)
+ * and then the number of the core, which defaults to 0. Binary traces hold neither, all their
+ * accesses are reads of core 0.
+ * @param trace trace to read
+ * @param access set to the access
+ * @return 1 if an access was read and 0 if the end of the trace was reached
+ */
+int read_core_transaction(trace_t *trace, core_access_t *access) {
+    access->access.repeats = 0;
+    access->core = 0;
+    access->write = 0;
+    while (1) {
+        int found = trace->format == binary ? read_binary_transaction(trace, &access->access)
+                                            : read_text_transaction(trace, &access->access, &access->core,
+                                                                    &access->write);
+        if (found || trace->fd < 0) {
+            return found;
+        }
+        refill_trace(trace);
+    }
+}
+
+/**
+ * Checks whether a trace can be rewound
+ *
+ * A streamed trace drops the records it has parsed when it reads more, so it can only be rewound
+ * once it has been read completely and nothing has been dropped: the whole trace is still in the buffer.
+ * @param trace the trace
+ * @return 1 if rewind_trace restarts the trace
+ */
+int trace_rewindable(const trace_t *trace) {
+    return !trace->buffer || (trace->fd < 0 && trace->size == trace->buffered);
+}
+
+/**
+ * Tells why a trace ended early, to be checked once the reads return 0
+ *
+ * A streamed trace that can not be read or decompressed any further ends like a complete trace,
+ * the caller reports the error.
+ * @param trace the trace
+ * @return NULL if the trace was read without errors, otherwise a description of the error
+ */
+const char *trace_error(const trace_t *trace) {
+    return trace->error;
+}
+
+/**
+ * Returns the position of the next access of a trace
+ * @param trace the trace
+ * @param position set to the offset of the next record in the (decompressed) trace and the decoder state
+ */
+void get_trace_position(const trace_t *trace, trace_position_t *position) {
+    if (trace->buffer) {
+        /* size counts the bytes read so far, the unparsed bytes are still in the buffer */
+        position->offset = trace->size - (trace->buffered - (size_t) (trace->pos - trace->buffer));
+    } else {
+        position->offset = (uint64_t) (trace->pos - trace->data);
+    }
+    position->last_address[instruction] = trace->last_address[instruction];
+    position->last_address[data] = trace->last_address[data];
+}
+
+/**
+ * Continues a trace at a position taken by get_trace_position on the same trace
+ *
+ * Streamed traces can only move forward, the bytes before the position are read and dropped.
+ * @param trace trace that has not been read yet
+ * @param position the position
+ * @return 0 on success, 1 if the trace ends before the position
+ */
+int seek_trace(trace_t *trace, const trace_position_t *position) {
+    uint64_t start = trace->format == binary ? BINARY_TRACE_MAGIC_LEN : 0;
+    if (position->offset < start) {
+        return 1;
+    }
+    if (trace->buffer) {
+        trace_position_t now;
+        get_trace_position(trace, &now);
+        while (now.offset < position->offset) {
+            size_t rest = trace->buffered - (size_t) (trace->pos - trace->buffer);
+            size_t skip = position->offset - now.offset < rest ? (size_t) (position->offset - now.offset) : rest;
+            trace->pos += skip;
+            now.offset += skip;
+            if (now.offset < position->offset) {
+                if (trace->fd < 0) {
+                    return 1;
+                }
+                refill_trace(trace);
+            }
+        }
+        if (now.offset > position->offset) {
+            return 1;
+        }
+    } else {
+        if (position->offset > trace->size) {
+            return 1;
+        }
+        trace->pos = trace->data + position->offset;
+    }
+    trace->last_address[instruction] = position->last_address[instruction];
+    trace->last_address[data] = position->last_address[data];
+    return 0;
+}
+
+/**
+ * Returns the size of a trace
+ * @param trace the trace
+ * @return size of the file in bytes, the bytes read so far for a streamed trace
+ */
+size_t trace_size(const trace_t *trace) {
+    return trace->size;
+}
+
+/**
+ * Converts a text trace into the binary trace format
+ * @param in_path path of the text trace
+ * @param out_path path of the binary trace that is written
+ * @return 0 on success, 1 otherwise
+ */
+int convert_trace(const char *in_path, const char *out_path) {
+    trace_t *trace = open_trace(in_path);
+    if (!trace) {
+        printf("Unable to open the trace file\n");
+        return 1;
+    }
+    if (trace->format != text) {
+        printf("%s is not a text trace\n", in_path);
+        close_trace(trace);
+        return 1;
+    }
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        printf("Unable to open %s\n", out_path);
+        close_trace(trace);
+        return 1;
+    }
+
+    uint8_t buf[1 << 16];
+    size_t len = 0;
+    uint32_t last_address[2] = {0, 0};
+    uint64_t count = 0;
+    mem_access_t access;
+    fwrite(BINARY_TRACE_MAGIC, 1, BINARY_TRACE_MAGIC_LEN, out);
+    while (read_transaction(trace, &access)) {
+        int32_t delta = (int32_t) (access.address - last_address[access.accesstype]);
+        uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+        uint64_t value = ((uint64_t) zigzag << 1) | access.accesstype;
+        last_address[access.accesstype] = access.address;
+
+        /* a record takes at most 5 bytes */
+        if (len + 5 > sizeof(buf)) {
+            fwrite(buf, 1, len, out);
+            len = 0;
+        }
+        while (value >= 0x80) {
+            buf[len++] = (uint8_t) (value | 0x80);
+            value >>= 7;
+        }
+        buf[len++] = (uint8_t) value;
+        count++;
+    }
+    fwrite(buf, 1, len, out);
+    if (trace_error(trace)) {
+        fprintf(stderr, "%s\n", trace_error(trace));
+        fclose(out);
+        close_trace(trace);
+        return 1;
+    }
+
+    int failed = ferror(out);
+    long out_size = ftell(out);
+    if (fclose(out) != 0 || failed) {
+        printf("Unable to write %s\n", out_path);
+        close_trace(trace);
+        return 1;
+    }
+    printf("Converted %" PRIu64 " accesses: %zu -> %ld bytes\n", count, trace->size, out_size);
+    close_trace(trace);
+    return 0;
+}
+
+/**
+ * Reads all remaining accesses of a trace into memory
+ * @param trace trace to read
+ * @param count set to the number of accesses read
+ * @return array of <count> accesses, to be freed by the caller
+ */
+mem_access_t *load_trace(trace_t *trace, uint64_t *count) {
+    uint64_t capacity = 1024;
+    uint64_t n = 0;
+    mem_access_t *accesses = malloc(capacity * sizeof(mem_access_t));
+    while (read_transaction(trace, &accesses[n])) {
+        if (++n == capacity) {
+            capacity *= 2;
+            accesses = realloc(accesses, capacity * sizeof(mem_access_t));
+        }
+    }
+    *count = n;
+    return accesses;
+}
@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cachesim.h"
+
+/* Memory access traces of libcachesim
+ *
+ * A text trace holds one access per line, I or D followed by the hexadecimal address. A binary trace
+ * (see convert_trace) holds the same accesses delta encoded. Either may be gzip or zstd compressed and
+ * read from a file, a pipe or stdin ("-"), files are memory mapped and pipes are streamed in chunks.
+ * Records of a multi-core text trace may carry two more fields, see read_core_transaction.
+ */
+typedef struct trace trace_t;
+
+/* Position of a trace, to continue reading it later (see seek_trace) */
+typedef struct {
+    uint64_t offset;            // bytes of the (decompressed) trace before the next record
+    uint32_t last_address[2];   // previous address per access type (binary traces only)
+} trace_position_t;
+
+trace_t *open_trace(const char *path);
+void close_trace(trace_t *trace);
+void rewind_trace(trace_t *trace);
+int trace_rewindable(const trace_t *trace);
+const char *trace_error(const trace_t *trace);
+size_t trace_size(const trace_t *trace);
+void get_trace_position(const trace_t *trace, trace_position_t *position);
+int seek_trace(trace_t *trace, const trace_position_t *position);
+int read_transaction(trace_t *trace, mem_access_t *access);
+int read_core_transaction(trace_t *trace, core_access_t *access);
+mem_access_t *load_trace(trace_t *trace, uint64_t *count);
+int convert_trace(const char *in_path, const char *out_path);
+
+#endif
@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <linux/input.h>
 #include <stdbool.h>
 #include <string.h>
@@ -12,6 +14,7 @@
 #include <linux/fb.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
 
 
 // The game state can be used to detect what happens on the playfield
@@ -29,13 +32,6 @@
 #define ORANGE 0xFBC0
 #define PURPLE 0x9215
 
-// If you extend this structure, either avoid pointers or adjust
-// the game logic allocate/deallocate and reset the memory
-typedef struct {
-    bool occupied;
-    u_int16_t color;
-} tile;
-
 typedef struct {
     unsigned int x;
     unsigned int y;
@@ -52,8 +48,11 @@ typedef struct {
     unsigned int score; // game score
     unsigned int level; // game level
 
-    tile *rawPlayfield; // pointer to raw memory of the playfield
-    tile **playfield;   // This is the play field array
+    // The playfield is a bitboard: one machine word per row, bit x of playfield[y]
+    // is set if tile (x, y) is occupied. The colors are kept separately.
+    unsigned long *playfield;
+    u_int16_t *colors;      // color of every tile row by row, only valid for occupied tiles
+    unsigned long fullRow;  // row word with every tile occupied
     unsigned int state;
     coord activeTile;                       // current tile
 
@@ -75,10 +74,19 @@ int led_fd = 0;     // led file descriptor
 int joystick_fd = 0;    // joystick file descriptor
 u_int16_t * led_fb_data;     // led framebuffer data
 struct fb_fix_screeninfo screen_info;   // led framebuffer info
-struct input_event joystick_event;  // joystick event buffer
-struct timeval timeval;     // timeval object for timeouts to improve user controls (see below)
-u_int16_t timeout = 175;    // timeout until next joystick input is read
-u_int64_t last_read = 0;
+u_int16_t * shadow_frame;    // frame composed in normal memory before it is written to the led framebuffer
+u_int16_t * shown_frame;     // frame last written to the led framebuffer
+bool frame_shown = false;    // shown_frame holds what the led framebuffer shows
+u_int64_t fb_frames = 0;     // frames rendered on the sense hat
+u_int64_t fb_bytes_written = 0;  // bytes written to the led framebuffer by these frames
+#define JOYSTICK_BATCH 64     // joystick events read at once
+u_int32_t repeat_delay = 250;       // ms a direction has to be held before it repeats
+u_int32_t repeat_interval = 125;    // ms between two repeats of a held direction
+int joystick_held = 0;              // key that is held down, 0 if none
+u_int64_t joystick_pressed_at = 0;  // time of the press of the held key in us
+u_int64_t joystick_repeated_at = 0; // time of the last action of the held key in us
+int joystick_pending = 0;           // key of the action for the next tick, 0 if none
+u_int64_t joystick_action_at = 0;   // time of the last joystick action in us
 const u_int16_t colors[] = {RED, BLUE, GREEN, YELLOW, ORANGE, PURPLE, CYAN, PINK, WHITE };
 u_int8_t current_color = 0;
 
@@ -116,8 +124,16 @@ bool initializeSenseHat() {
     // map virtual address space of the sense hat to memory
     led_fb_data = mmap(NULL, screen_info.smem_len, PROT_READ | PROT_EXEC | PROT_WRITE, MAP_SHARED, led_fd, 0);
 
-    // open joystick event file
-    joystick_fd = open("/dev/input/event0", O_RDONLY);
+    // frames are composed in a shadow frame and only the difference to the shown frame is written
+    shadow_frame = malloc(screen_info.smem_len);
+    shown_frame = malloc(screen_info.smem_len);
+    if (!shadow_frame || !shown_frame) {
+        printf("Could not allocate the shadow frames\n");
+        return false;
+    }
+
+    // open joystick event file, the pending events are drained without blocking
+    joystick_fd = open("/dev/input/event0", O_RDONLY | O_NONBLOCK);
     if (joystick_fd == -1) {
         printf("Could not open joystick event file\n");
         return false;
@@ -142,6 +158,15 @@ bool initializeSenseHat() {
 // Here you can free up everything that you might have opened/allocated
 void freeSenseHat() {
 
+    // report how much of the framebuffer the frames rewrote
+    if (fb_frames) {
+        fprintf(stderr, "Sense HAT: %llu frames, %llu bytes written, %.1f bytes per frame (full frame: %u bytes)\n",
+                (unsigned long long) fb_frames, (unsigned long long) fb_bytes_written,
+                (double) fb_bytes_written / fb_frames, screen_info.smem_len);
+    }
+    free(shadow_frame);
+    free(shown_frame);
+
     // clear sense hat at the end of the game
     memset(led_fb_data, 0, screen_info.smem_len);
 
@@ -152,33 +177,75 @@ void freeSenseHat() {
     close(led_fd);
 }
 
+// time of the monotonic clock in us
+u_int64_t uSecNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+// Returns the pending joystick action if no action was returned in the current tick,
+// so the actions of a held key or of fast presses are spread over the ticks
+int nextJoystickAction() {
+    if (!joystick_pending)
+        return 0;
+    u_int64_t const now = uSecNow();
+    if (now - joystick_action_at < game.uSecTickTime)
+        return 0;
+    int const key = joystick_pending;
+    joystick_pending = 0;
+    joystick_action_at = now;
+    return key;
+}
+
 // This function should return the key that corresponds to the joystick press
 // KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, with the respective direction
 // and KEY_ENTER, when the the joystick is pressed
 // !!! when nothing was pressed you MUST return 0 !!!
 int readSenseHatJoystick() {
-    struct pollfd pollJoystick = {
-        .fd = joystick_fd,
-        .events = POLLIN
-    };
-
-    // check if a new joystick event is present
-    if (poll(&pollJoystick, 1, 0)) {
-
-        // read the event if present, otherwise a queue will form
-        read(joystick_fd, &joystick_event, sizeof(joystick_event));
-
-        // only return the joystick event if the timeout has passed. This improves controllability
-        gettimeofday(&timeval, NULL);
-        if ((timeval.tv_sec * 1000LL + timeval.tv_usec / 1000) - last_read > timeout) {
-            last_read = (timeval.tv_sec * 1000LL + timeval.tv_usec / 1000);
-            return joystick_event.code;
+    struct input_event events[JOYSTICK_BATCH];
+    ssize_t n;
+
+    // drain all pending events, a single read returns as many whole events as fit
+    do {
+        n = read(joystick_fd, events, sizeof(events));
+        u_int64_t const now = uSecNow();
+        for (ssize_t i = 0; i < n / (ssize_t) sizeof(struct input_event); i++) {
+            if (events[i].type != EV_KEY)
+                continue;
+            switch (events[i].value) {
+                case 1:
+                    // a press always acts, the latest press of a tick wins
+                    joystick_held = events[i].code;
+                    joystick_pressed_at = now;
+                    joystick_repeated_at = now;
+                    joystick_pending = events[i].code;
+                    break;
+                case 2:
+                    // the autorepeat of the kernel acts at the configured delay and interval
+                    if (events[i].code == joystick_held && !joystick_pending &&
+                        now - joystick_pressed_at >= repeat_delay * 1000ULL &&
+                        now - joystick_repeated_at >= repeat_interval * 1000ULL) {
+                        joystick_repeated_at = now;
+                        joystick_pending = events[i].code;
+                    }
+                    break;
+                case 0:
+                    if (events[i].code == joystick_held)
+                        joystick_held = 0;
+                    break;
+            }
         }
-    }
-    return 0;
+    } while (n == sizeof(events));
+
+    return nextJoystickAction();
 }
 
 
+// playfield interface, defined below the renderers
+static inline bool tileOccupied(coord const target);
+static inline u_int16_t tileColor(coord const target);
+
 // This function should render the gamefield on the LED matrix. It is called
 // every game tick. The parameter playfieldChanged signals whether the game logic
 // has changed the playfield
@@ -187,18 +254,48 @@ void renderSenseHatMatrix(bool const playfieldChanged) {
 
     // only update the sense hat if the playing field changed
     if (playfieldChanged) {
-        // clear the entire screen
-        memset(led_fb_data, 0, screen_info.smem_len);
+        unsigned int const pixels = screen_info.smem_len / sizeof(u_int16_t);
 
-        // set the pixels corresponding to the occupied cells
+        // compose the frame in the shadow frame
+        memset(shadow_frame, 0, screen_info.smem_len);
         for (int row = 0; row < game.grid.y; row++) {
             for (int col = 0; col < game.grid.x; col++) {
-                if (game.playfield[row][col].occupied) {
+                coord const checkTile = {col, row};
+                if (tileOccupied(checkTile)) {
                     // turn on the corresponding pixel on the sense hat
-                    led_fb_data[row * 8 + col] = game.playfield[row][col].color;
+                    shadow_frame[row * 8 + col] = tileColor(checkTile);
                 }
             }
         }
+
+        // count the pixels that differ from the shown frame, the first frame rewrites every pixel
+        unsigned int changed = pixels;
+        if (frame_shown) {
+            changed = 0;
+            for (unsigned int i = 0; i < pixels; i++) {
+                changed += shadow_frame[i] != shown_frame[i];
+            }
+        }
+
+        // write the changed pixels, or the whole frame at once if most of them changed
+        if (changed * 2 > pixels) {
+            memcpy(led_fb_data, shadow_frame, screen_info.smem_len);
+            fb_bytes_written += screen_info.smem_len;
+        } else if (changed) {
+            for (unsigned int i = 0; i < pixels; i++) {
+                if (shadow_frame[i] != shown_frame[i]) {
+                    led_fb_data[i] = shadow_frame[i];
+                }
+            }
+            fb_bytes_written += changed * sizeof(u_int16_t);
+        }
+        fb_frames++;
+
+        // the composed frame is shown now
+        u_int16_t *const frame = shown_frame;
+        shown_frame = shadow_frame;
+        shadow_frame = frame;
+        frame_shown = true;
     }
 }
 
@@ -208,44 +305,43 @@ void renderSenseHatMatrix(bool const playfieldChanged) {
 // adjust this game logic <> playfield interface
 
 static inline void newTile(coord const target) {
-    game.playfield[target.y][target.x].occupied = true;
-    game.playfield[target.y][target.x].color = pick_color();
+    game.playfield[target.y] |= 1UL << target.x;
+    game.colors[target.y * game.grid.x + target.x] = pick_color();
 }
 
 static inline void copyTile(coord const to, coord const from) {
-    memcpy((void *) &game.playfield[to.y][to.x], (void *) &game.playfield[from.y][from.x], sizeof(tile));
+    unsigned long const bit = (game.playfield[from.y] >> from.x) & 1UL;
+    game.playfield[to.y] = (game.playfield[to.y] & ~(1UL << to.x)) | (bit << to.x);
+    game.colors[to.y * game.grid.x + to.x] = game.colors[from.y * game.grid.x + from.x];
 }
 
 static inline void copyRow(unsigned int const to, unsigned int const from) {
-    memcpy((void *) &game.playfield[to][0], (void *) &game.playfield[from][0], sizeof(tile) * game.grid.x);
-
+    game.playfield[to] = game.playfield[from];
+    // the colors of an empty row are never read
+    if (game.playfield[from]) {
+        memcpy((void *) &game.colors[to * game.grid.x], (void *) &game.colors[from * game.grid.x],
+               sizeof(u_int16_t) * game.grid.x);
+    }
 }
 
 static inline void resetTile(coord const target) {
-    memset((void *) &game.playfield[target.y][target.x], 0, sizeof(tile));
+    game.playfield[target.y] &= ~(1UL << target.x);
 }
 
 static inline void resetRow(unsigned int const target) {
-    memset((void *) &game.playfield[target][0], 0, sizeof(tile) * game.grid.x);
+    game.playfield[target] = 0;
 }
 
-static inline bool
-tileOccupied(coord
-const target) {
-return game.playfield[target.y][target.x].
-occupied;
+static inline bool tileOccupied(coord const target) {
+    return (game.playfield[target.y] >> target.x) & 1UL;
 }
 
-static inline bool
+static inline u_int16_t tileColor(coord const target) {
+    return game.colors[target.y * game.grid.x + target.x];
+}
 
-rowOccupied(unsigned int const target) {
-    for (unsigned int x = 0; x < game.grid.x; x++) {
-        coord const checkTile = {x, target};
-        if (!tileOccupied(checkTile)) {
-            return false;
-        }
-    }
-    return true;
+static inline bool rowOccupied(unsigned int const target) {
+    return game.playfield[target] == game.fullRow;
 }
 
 
@@ -443,46 +539,147 @@ int readKeyboard() {
     return 0;
 }
 
-void renderConsole(bool const playfieldChanged) {
-    if (!playfieldChanged)
-        return;
+// The console frame is composed as text in a preallocated buffer and compared with the frame
+// shown on the console. Only the changed characters are sent, each run after a cursor move,
+// in a single write.
+#define CONSOLE_HUD_WIDTH 18    // width of the statistics right of the playfield
+#define CURSOR_MOVE_COST 6      // bytes of the shortest cursor move, shorter gaps are resent instead
+#define CURSOR_MOVE_MAX 24      // bytes of the longest cursor move
+
+char *console_frame;        // composed frame, console_rows lines of console_cols characters
+char *console_shown;        // frame shown on the console
+char *console_out;          // cursor moves and characters sent for one frame
+unsigned int console_rows;
+unsigned int console_cols;
+u_int64_t console_frames = 0;   // frames rendered on the console
+u_int64_t console_bytes = 0;    // bytes written to the console by these frames
+u_int64_t console_writes = 0;   // write calls of these frames
+
+// Allocates the console frames and clears the console, return false if something fails
+bool initializeConsole() {
+    console_rows = game.grid.y + 2;
+    console_cols = game.grid.x + 2 + CONSOLE_HUD_WIDTH;
+    console_frame = malloc(console_rows * console_cols);
+    console_shown = malloc(console_rows * console_cols);
+    // runs of a line are at least CURSOR_MOVE_COST characters apart, the frame ends with a cursor move
+    console_out = malloc(console_rows * (console_cols + (console_cols / (CURSOR_MOVE_COST + 1) + 1) * CURSOR_MOVE_MAX) +
+                         CURSOR_MOVE_MAX);
+    if (!console_frame || !console_shown || !console_out) {
+        return false;
+    }
+
+    // the cleared console shows a blank frame
+    memset(console_shown, ' ', console_rows * console_cols);
+    fprintf(stdout, "\033[H\033[J");
+    fflush(stdout);
+    return true;
+}
 
-    // Goto beginning of console
-    fprintf(stdout, "\033[%d;%dH", 0, 0);
-    for (unsigned int x = 0; x < game.grid.x + 2; x++) {
-        fprintf(stdout, "-");
+// Reports the bytes and write calls per frame and frees the console frames
+void freeConsole() {
+    if (console_frames) {
+        fprintf(stderr, "\nConsole: %llu frames, %llu bytes in %llu writes, %.1f bytes and %.2f writes per frame\n",
+                (unsigned long long) console_frames, (unsigned long long) console_bytes,
+                (unsigned long long) console_writes, (double) console_bytes / console_frames,
+                (double) console_writes / console_frames);
     }
-    fprintf(stdout, "\n");
+    free(console_frame);
+    free(console_shown);
+    free(console_out);
+}
+
+// Composes the playfield and the statistics into console_frame
+static void composeConsole() {
+    memset(console_frame, ' ', console_rows * console_cols);
+    memset(console_frame, '-', game.grid.x + 2);
     for (unsigned int y = 0; y < game.grid.y; y++) {
-        fprintf(stdout, "|");
+        char *const line = &console_frame[(y + 1) * console_cols];
+        line[0] = '|';
         for (unsigned int x = 0; x < game.grid.x; x++) {
             coord const checkTile = {x, y};
-            fprintf(stdout, "%c", (tileOccupied(checkTile)) ? '#' : ' ');
+            line[x + 1] = (tileOccupied(checkTile)) ? '#' : ' ';
         }
+        line[game.grid.x + 1] = '|';
+
+        char hud[CONSOLE_HUD_WIDTH + 1];
+        int length = 0;
         switch (y) {
             case 0:
-                fprintf(stdout, "| Tiles: %10u\n", game.tiles);
+                length = snprintf(hud, sizeof(hud), " Tiles: %10u", game.tiles);
                 break;
             case 1:
-                fprintf(stdout, "| Rows:  %10u\n", game.rows);
+                length = snprintf(hud, sizeof(hud), " Rows:  %10u", game.rows);
                 break;
             case 2:
-                fprintf(stdout, "| Score: %10u\n", game.score);
+                length = snprintf(hud, sizeof(hud), " Score: %10u", game.score);
                 break;
             case 4:
-                fprintf(stdout, "| Level: %10u\n", game.level);
+                length = snprintf(hud, sizeof(hud), " Level: %10u", game.level);
                 break;
             case 7:
-                fprintf(stdout, "| %17s\n", (game.state == GAMEOVER) ? "Game Over" : "");
+                length = snprintf(hud, sizeof(hud), " %17s", (game.state == GAMEOVER) ? "Game Over" : "");
                 break;
-            default:
-                fprintf(stdout, "|\n");
         }
+        if (length > CONSOLE_HUD_WIDTH) {
+            length = CONSOLE_HUD_WIDTH;
+        }
+        memcpy(&line[game.grid.x + 2], hud, length);
     }
-    for (unsigned int x = 0; x < game.grid.x + 2; x++) {
-        fprintf(stdout, "-");
+    memset(&console_frame[(console_rows - 1) * console_cols], '-', game.grid.x + 2);
+}
+
+void renderConsole(bool const playfieldChanged) {
+    if (!playfieldChanged)
+        return;
+
+    composeConsole();
+
+    // collect the runs of changed characters, runs closer than a cursor move are merged
+    size_t length = 0;
+    for (unsigned int row = 0; row < console_rows; row++) {
+        char const *const line = &console_frame[row * console_cols];
+        char const *const shown = &console_shown[row * console_cols];
+        unsigned int col = 0;
+        while (col < console_cols) {
+            if (line[col] == shown[col]) {
+                col++;
+                continue;
+            }
+            unsigned int end = col + 1;
+            for (unsigned int next = end; next < console_cols && next < end + CURSOR_MOVE_COST; next++) {
+                if (line[next] != shown[next]) {
+                    end = next + 1;
+                }
+            }
+            length += sprintf(&console_out[length], "\033[%u;%uH", row + 1, col + 1);
+            memcpy(&console_out[length], &line[col], end - col);
+            length += end - col;
+            col = end;
+        }
     }
-    fflush(stdout);
+
+    // leave the cursor behind the playfield and send the frame at once
+    if (length) {
+        length += sprintf(&console_out[length], "\033[%u;%uH", console_rows, game.grid.x + 3);
+        size_t written = 0;
+        while (written < length) {
+            ssize_t const n = write(STDOUT_FILENO, &console_out[written], length - written);
+            console_writes++;
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            written += n;
+        }
+    }
+    console_frames++;
+    console_bytes += length;
+
+    // the composed frame is shown now
+    char *const frame = console_shown;
+    console_shown = console_frame;
+    console_frame = frame;
 }
 
 
@@ -490,9 +687,63 @@ inline unsigned long uSecFromTimespec(struct timespec const ts) {
     return ((ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
 }
 
+u_int64_t tick_due_at = 0;  // time of the tick game.tick counts next in us
+
+// Runs the ticks that are due by now. Only the tick at which game.tick wraps to 0 updates the
+// game, the others only count, so the timer just wakes the process for that one.
+bool runTicks(u_int64_t const now) {
+    bool playfieldChanged = false;
+    // while the game is over the ticks change nothing, they are skipped at once
+    if (!(game.state & ACTIVE) && tick_due_at <= now)
+        tick_due_at += (now - tick_due_at) / game.uSecTickTime * game.uSecTickTime;
+    while (tick_due_at <= now) {
+        playfieldChanged |= sTetris(0);
+        game.tick = (game.tick + 1) % game.nextGameTick;
+        tick_due_at += game.uSecTickTime;
+    }
+    return playfieldChanged;
+}
+
+// Arms the one-shot timer for the next game update or the joystick action held back in the
+// current tick, whichever comes first. Keys, drops and new levels move the next update, so the
+// timer is armed again after every wakeup. While the game is over it stays disarmed.
+bool armTimer(int const timer_fd) {
+    u_int64_t at = 0;
+    if (game.state & ACTIVE)
+        at = tick_due_at + (game.nextGameTick - game.tick) % game.nextGameTick * game.uSecTickTime;
+    if (joystick_pending && (!at || joystick_action_at + game.uSecTickTime < at))
+        at = joystick_action_at + game.uSecTickTime;
+    struct itimerspec const next = {
+            .it_value = {at / 1000000, (at % 1000000) * 1000},
+    };
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &next, NULL) == 0;
+}
+
+// Applies a key as soon as it was read, between two game ticks. Only the keys that
+// run a game tick themselves (dropping the tile, starting a new game) may do so,
+// afterwards the tick count restarts as if that game tick had just passed.
+bool handleInput(int const key) {
+    if (!key)
+        return false;
+    unsigned long const tick = game.tick;
+    game.tick = 1;      // any value but 0, the pending game tick is run by the timer
+    bool const playfieldChanged = sTetris(key);
+    game.tick = (game.tick == 0) ? 1 % game.nextGameTick : tick;
+    return playfieldChanged;
+}
+
 int main(int argc, char **argv) {
-    (void) argc;
-    (void) argv;
+    // Optional joystick repeat rates: --repeat-delay MS and --repeat-interval MS
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repeat-delay") == 0 && i + 1 < argc) {
+            repeat_delay = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--repeat-interval") == 0 && i + 1 < argc) {
+            repeat_interval = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [--repeat-delay MS] [--repeat-interval MS]\n", argv[0]);
+            return 1;
+        }
+    }
     // This sets the stdin in a special state where each
     // keyboard press is directly flushed to the stdin and additionally
     // not outputted to the stdout
@@ -504,16 +755,18 @@ int main(int argc, char **argv) {
         tcsetattr(STDIN_FILENO, TCSANOW, &ttystate);
     }
 
-    // Allocate the playing field structure
-    game.rawPlayfield = (tile *) malloc(game.grid.x * game.grid.y * sizeof(tile));
-    game.playfield = (tile **) malloc(game.grid.y * sizeof(tile *));
-    if (!game.playfield || !game.rawPlayfield) {
-        fprintf(stderr, "ERROR: could not allocate playfield\n");
+    // Allocate the playing field structure, a row has to fit into a word
+    if (game.grid.x > sizeof(unsigned long) * 8) {
+        fprintf(stderr, "ERROR: the playfield can be at most %zu tiles wide\n", sizeof(unsigned long) * 8);
         return 1;
     }
-    for (unsigned int y = 0; y < game.grid.y; y++) {
-        game.playfield[y] = &(game.rawPlayfield[y * game.grid.x]);
+    game.playfield = (unsigned long *) malloc(game.grid.y * sizeof(unsigned long));
+    game.colors = (u_int16_t *) malloc(game.grid.x * game.grid.y * sizeof(u_int16_t));
+    if (!game.playfield || !game.colors) {
+        fprintf(stderr, "ERROR: could not allocate playfield\n");
+        return 1;
     }
+    game.fullRow = game.grid.x == sizeof(unsigned long) * 8 ? ~0UL : (1UL << game.grid.x) - 1;
 
     // Reset playfield to make it empty
     resetPlayfield();
@@ -526,37 +779,85 @@ int main(int argc, char **argv) {
     };
 
     // Clear console, render first time
-    fprintf(stdout, "\033[H\033[J");
+    if (!initializeConsole()) {
+        fprintf(stderr, "ERROR: could not allocate console frames\n");
+        return 1;
+    }
     renderConsole(true);
     renderSenseHatMatrix(true);
 
-    while (true) {
-        struct timeval sTv, eTv;
-        gettimeofday(&sTv, NULL);
-
-        int key = readSenseHatJoystick();
-        if (!key)
-            key = readKeyboard();
-        if (key == KEY_ENTER)
+    // One epoll set waits for the joystick, the keyboard and a monotonic timer for the next game
+    // update, so input is handled when it arrives and the process sleeps in between
+    int const epoll_fd = epoll_create1(0);
+    int const timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    tick_due_at = uSecNow() + game.uSecTickTime;
+    struct epoll_event timerEvent = {.events = EPOLLIN, .data.fd = timer_fd};
+    struct epoll_event joystickEvent = {.events = EPOLLIN, .data.fd = joystick_fd};
+    struct epoll_event keyboardEvent = {.events = EPOLLIN, .data.fd = STDIN_FILENO};
+    if (epoll_fd < 0 || timer_fd < 0 || !armTimer(timer_fd) ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timerEvent) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, joystick_fd, &joystickEvent) < 0) {
+        fprintf(stderr, "ERROR: could not set up the event loop\n");
+        return 1;
+    }
+    // stdin may be a file, which epoll does not support, the game then runs without keyboard
+    bool keyboard = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &keyboardEvent) == 0;
+    // every key is read straight from stdin, so no key waits in a stdio buffer epoll can not see
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    bool running = true;
+    while (running) {
+        struct epoll_event events[3];
+        int const count = epoll_wait(epoll_fd, events, 3, -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
             break;
+        }
 
-        bool playfieldChanged = sTetris(key);
+        // catch up with the ticks since the last wakeup before any key is applied
+        bool playfieldChanged = runTicks(uSecNow());
+        for (int i = 0; i < count && running; i++) {
+            int const fd = events[i].data.fd;
+            if (fd == timer_fd) {
+                u_int64_t expirations = 0;
+                if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    continue;
+                // a joystick action held back in the last tick
+                int const key = nextJoystickAction();
+                if (key == KEY_ENTER) {
+                    running = false;
+                    break;
+                }
+                playfieldChanged |= handleInput(key);
+            } else {
+                int const key = (fd == joystick_fd) ? readSenseHatJoystick() : readKeyboard();
+                if (key == KEY_ENTER) {
+                    running = false;
+                    break;
+                }
+                playfieldChanged |= handleInput(key);
+                // stop waiting for a keyboard that was closed
+                if (fd == STDIN_FILENO && keyboard && feof(stdin)) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                    keyboard = false;
+                }
+            }
+        }
         renderConsole(playfieldChanged);
         renderSenseHatMatrix(playfieldChanged);
-
-        // Wait for next tick
-        gettimeofday(&eTv, NULL);
-        unsigned long const uSecProcessTime =
-                ((eTv.tv_sec * 1000000) + eTv.tv_usec) - ((sTv.tv_sec * 1000000 + sTv.tv_usec));
-        if (uSecProcessTime < game.uSecTickTime) {
-            usleep(game.uSecTickTime - uSecProcessTime);
+        if (running && !armTimer(timer_fd)) {
+            fprintf(stderr, "ERROR: could not arm the game timer\n");
+            break;
         }
-        game.tick = (game.tick + 1) % game.nextGameTick;
     }
 
+    close(timer_fd);
+    close(epoll_fd);
+    freeConsole();
     freeSenseHat();
     free(game.playfield);
-    free(game.rawPlayfield);
+    free(game.colors);
 
     return 0;
 }